@@ -0,0 +1,124 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFCACHE_H
+#define _HFCACHE_H
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "hft/hft.hpp"
+
+#define HF_CACHE_SHARDS 16
+#define HF_CACHE_PREFIX_BITS 8
+#define HF_CACHE_MAX_RESULTS 4096
+
+namespace hft {
+
+	enum hf_cache_mode_t {
+		HF_CACHE_EXACT = 0,
+		HF_CACHE_FAST
+	};
+
+	/**
+	 * Cache of range search results keyed on (target, radius, mode), split into
+	 * shards with a CLOCK replacement policy each.  Writes are tracked per subtree:
+	 * every prefix of HF_CACHE_PREFIX_BITS key bits holds the time of its last
+	 * write, and a cached result is only returned if no subtree within radius of
+	 * the target prefix was written since the result was computed.  A write thus
+	 * invalidates just the queries whose search region it may touch.
+	 **/
+	class HFResultCache {
+	private:
+		struct key_t {
+			uint64_t code;
+			int radius;
+			int mode;
+			bool operator==(const key_t &other)const {
+				return code == other.code && radius == other.radius && mode == other.mode;
+			}
+		};
+
+		struct key_hash_t {
+			size_t operator()(const key_t &key)const;
+		};
+
+		struct slot_t {
+			key_t key;
+			uint64_t stamp;
+			std::vector<hf_t> results;
+			bool used;
+			bool referenced;
+		};
+
+		struct alignas(64) shard_t {
+			std::mutex mutex;
+			std::unordered_map<key_t, size_t, key_hash_t> index;
+			std::vector<slot_t> slots;
+			size_t hand;
+		};
+
+		shard_t *m_shards;
+		size_t m_capacity;
+		std::atomic<uint64_t> m_clock;
+		std::atomic<uint64_t> m_written[1 << HF_CACHE_PREFIX_BITS];
+		std::atomic<uint64_t> m_hits;
+		std::atomic<uint64_t> m_misses;
+
+		bool IsCurrent(const uint64_t key, const int radius, const uint64_t stamp)const;
+
+	public:
+		/* holds up to capacity results; throws std::invalid_argument if capacity is 0 */
+		HFResultCache(const size_t capacity);
+		~HFResultCache();
+		HFResultCache(const HFResultCache &other) = delete;
+		HFResultCache& operator=(const HFResultCache &other) = delete;
+
+		/* time to pass to Put for a search that starts now */
+		uint64_t Stamp()const;
+
+		/**
+		 * Append the cached results for target code to results, and return true,
+		 * if they are still current.  key is code in the key space of the trie.
+		 **/
+		bool Get(const uint64_t code, const uint64_t key, const int radius, const hf_cache_mode_t mode,
+				 std::vector<hf_t> &results);
+
+		/* cache the results from start on, unless there are more than HF_CACHE_MAX_RESULTS */
+		void Put(const uint64_t code, const int radius, const hf_cache_mode_t mode,
+				 const std::vector<hf_t> &results, const size_t start, const uint64_t stamp);
+
+		/* record a write of key, in the key space of the trie */
+		void Invalidate(const uint64_t key);
+
+		/* drop all results */
+		void InvalidateAll();
+
+		uint64_t Hits()const;
+
+		uint64_t Misses()const;
+
+		size_t Size()const;
+
+		size_t MemoryUsage()const;
+	};
+}
+
+#endif /* _HFCACHE_H */
@@ -0,0 +1,86 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFCLIENT_H
+#define _HFCLIENT_H
+
+#include <string>
+#include <vector>
+#include "hft/hfproto.hpp"
+
+namespace hft {
+
+	/**
+	 * Client for HFServer.  Requests may be pipelined: Send() only buffers,
+	 * Flush() writes everything buffered and Receive() returns responses in the
+	 * order the requests were sent.  The synchronous calls do all three, and
+	 * pass over responses to earlier requests that were never received.
+	 * Throws std::runtime_error on connection errors.
+	 **/
+	class HFClient {
+	private:
+		int m_fd;
+		uint32_t m_next_id;
+		std::string m_out;
+		std::string m_in;
+		size_t m_in_pos;
+
+		hf_response_t Call(const hf_request_t &req);
+		bool DecodeBuffered(hf_response_t &resp);
+
+	public:
+		HFClient();
+		~HFClient();
+		HFClient(const HFClient &other) = delete;
+		HFClient& operator=(const HFClient &other) = delete;
+
+		void ConnectUnix(const std::string &path);
+
+		void ConnectTCP(const int port, const std::string &host="127.0.0.1");
+
+		void Close();
+
+		/* buffer a request, returning its request id */
+		uint32_t Send(const hf_request_t &req);
+
+		void Flush();
+
+		void Receive(hf_response_t &resp);
+
+		/* wait at most timeout_ms (-1 for no limit) for a response; false on timeout */
+		bool Receive(hf_response_t &resp, const int timeout_ms);
+
+		/* socket descriptor, to poll several clients at once */
+		int Fd()const;
+
+		void Insert(const hf_t &item);
+
+		void Delete(const hf_t &item);
+
+		std::vector<hf_t> RangeSearch(const uint64_t target, const int radius);
+
+		std::vector<hf_t> RangeSearchFast(const uint64_t target, const int radius);
+
+		std::vector<hf_t> KNearestSearch(const uint64_t target, const int k);
+
+		size_t Count(const uint64_t target, const int radius);
+	};
+}
+
+#endif /* _HFCLIENT_H */
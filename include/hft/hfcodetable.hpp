@@ -0,0 +1,82 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFCODETABLE_H
+#define _HFCODETABLE_H
+
+#include <vector>
+#include "hft/hft.hpp"
+
+#define HF_TABLE_MIN_SLOTS 16
+#define HF_TABLE_PREFETCH 8
+
+/* marks a free slot; entries with this code are kept aside */
+#define HF_TABLE_EMPTY 0x5bd1e9955bd1e995ULL
+
+namespace hft {
+
+	/**
+	 * Open addressing multimap from codes to entries, with linear probing
+	 * and at most half of the slots in use.  Each slot is an entry, so an
+	 * exact lookup costs about one cache miss.  Entries sharing a code sit
+	 * in the same run of slots.  Deletes shift the rest of the run back,
+	 * so no tombstones build up.
+	 **/
+	class HFCodeTable {
+	private:
+		std::vector<hf_t> m_slots;
+		std::vector<hf_id_t> m_empty_ids;
+		size_t m_count;
+		int m_shift;
+
+		size_t Home(const uint64_t code)const;
+		void Place(const hf_t &item);
+		void Rehash(const size_t n_slots);
+
+	public:
+		HFCodeTable();
+
+		void Insert(const hf_t &item);
+
+		/* make room for n entries in total */
+		void Reserve(const size_t n);
+
+		/* remove all entries equal to item */
+		void Delete(const hf_t &item);
+
+		bool Contains(const uint64_t code)const;
+
+		/* append all entries with code to results */
+		void Lookup(const uint64_t code, std::vector<hf_t> &results)const;
+
+		/* batched forms, prefetching the slots of the next few codes while probing */
+		std::vector<bool> Contains(const std::vector<uint64_t> &codes)const;
+
+		std::vector<std::vector<hf_t>> Lookup(const std::vector<uint64_t> &codes)const;
+
+		size_t Size()const;
+
+		void Clear();
+
+		/* bytes allocated for slots */
+		size_t MemoryUsage()const;
+	};
+}
+
+#endif /* _HFCODETABLE_H */
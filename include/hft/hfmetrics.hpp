@@ -0,0 +1,149 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFMETRICS_H
+#define _HFMETRICS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "hft/hft.hpp"
+
+#define HF_HIST_SUBBITS 3
+#define HF_HIST_BUCKETS 496
+#define HF_METRIC_SHARDS 16
+#define HF_MAX_LEVELS (NDIMS/CHUNKSIZE + 1)
+
+namespace hft {
+
+	enum hf_op_t {
+		HF_OP_INSERT = 0,
+		HF_OP_DELETE,
+		HF_OP_RANGESEARCH,
+		HF_OP_RANGESEARCHFAST,
+		HF_OP_RANGESEARCHPARALLEL,
+		HF_OP_RANGESEARCHFLAT,
+		HF_OP_RANGESEARCHMASKED,
+		HF_OP_COUNT
+	};
+
+	enum hf_counter_t {
+		HF_CTR_LEAF_SPLITS = 0,
+		HF_CTR_FLAT_SCANS,
+		HF_CTR_CACHE_HITS,
+		HF_CTR_CACHE_MISSES,
+		HF_CTR_ROOT_SLOTS,
+		HF_CTR_COUNT
+	};
+
+	/**
+	 * Log-linear histogram, 3 significant bits per power of two.
+	 * Recording is a relaxed atomic increment, so it is safe from any thread.
+	 **/
+	class HFHistogram {
+	private:
+		std::atomic<uint64_t> m_counts[HF_HIST_BUCKETS];
+		std::atomic<uint64_t> m_sum;
+		std::atomic<uint64_t> m_max;
+
+	public:
+		HFHistogram();
+
+		static int BucketOf(const uint64_t value);
+
+		static uint64_t BucketUpperBound(const int bucket);
+
+		void Record(const uint64_t value);
+
+		void Reset();
+
+		friend struct hf_histogram_snapshot_t;
+	};
+
+	struct hf_histogram_snapshot_t {
+		std::vector<uint64_t> counts;
+		uint64_t count;
+		uint64_t sum;
+		uint64_t max;
+
+		hf_histogram_snapshot_t();
+
+		void Merge(const HFHistogram &hist);
+
+		double Mean()const;
+
+		uint64_t Percentile(const double q)const;
+	};
+
+	struct hf_metrics_snapshot_t {
+		hf_histogram_snapshot_t latency[HF_OP_COUNT];
+		hf_histogram_snapshot_t result_sizes;
+		uint64_t counters[HF_CTR_COUNT];
+		long long internal_nodes[HF_MAX_LEVELS];
+		long long leaf_nodes[HF_MAX_LEVELS];
+
+		/* latencies in seconds, as a prometheus text exposition */
+		std::string ToPrometheus()const;
+
+		/* latencies in nanoseconds */
+		std::string ToJSON()const;
+	};
+
+	/**
+	 * Opt-in metrics for a HFTrie.  Latencies (in nanoseconds) and result sizes are
+	 * recorded into one of several shards picked per thread so that concurrent
+	 * readers do not contend on the same cache lines.
+	 **/
+	class HFMetrics {
+	private:
+		struct alignas(64) shard_t {
+			HFHistogram latency[HF_OP_COUNT];
+			HFHistogram result_sizes;
+		};
+
+		shard_t *m_shards;
+		std::atomic<uint64_t> m_counters[HF_CTR_COUNT];
+		std::atomic<long long> m_internal[HF_MAX_LEVELS];
+		std::atomic<long long> m_leaves[HF_MAX_LEVELS];
+
+		shard_t& LocalShard();
+
+	public:
+		HFMetrics();
+		~HFMetrics();
+		HFMetrics(const HFMetrics &other) = delete;
+		HFMetrics& operator=(const HFMetrics &other) = delete;
+
+		void RecordLatency(const hf_op_t op, const uint64_t nsecs);
+
+		void RecordResults(const size_t n);
+
+		void Increment(const hf_counter_t ctr, const uint64_t n=1);
+
+		void AddNodes(const int level, const long long n_internal, const long long n_leaves);
+
+		void ResetNodes();
+
+		void Reset();
+
+		hf_metrics_snapshot_t Snapshot()const;
+	};
+}
+
+#endif /* _HFMETRICS_H */
@@ -0,0 +1,82 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFMULTI_H
+#define _HFMULTI_H
+
+#include <unordered_map>
+#include <vector>
+#include "hft/hft.hpp"
+
+#define HF_MAX_SUBSTRINGS 16
+#define HF_DIRECT_BITS 16
+
+namespace hft {
+
+	/**
+	 * Multi-index hashing for exact range search.  Each code is split into m
+	 * disjoint substrings with one exact-match table per substring.  By the
+	 * pigeonhole principle, any code within radius r of the target is within
+	 * floor(r/m) of it on at least one substring, so a query enumerates the
+	 * substring values within floor(r/m) in each table and verifies the
+	 * candidates against the full code.  A candidate is only reported from the
+	 * first table in which it qualifies, which removes duplicates without a set.
+	 **/
+	class HFMultiIndex {
+	private:
+		typedef std::vector<uint32_t> bucket_t;
+
+		int m_nsubs;
+		int m_start[HF_MAX_SUBSTRINGS];
+		int m_len[HF_MAX_SUBSTRINGS];
+
+		std::vector<hf_t> m_entries;
+		std::vector<uint32_t> m_free;
+		size_t m_count;
+
+		/* tables of substrings up to HF_DIRECT_BITS long are directly indexed */
+		std::vector<std::vector<bucket_t>> m_direct;
+		std::vector<std::unordered_map<uint64_t, bucket_t>> m_hashed;
+
+		uint64_t Substring(const uint64_t code, const int s)const;
+		uint64_t SubstringMask(const int s)const;
+		bucket_t* GetBucket(const int s, const uint64_t key, const bool create);
+		const bucket_t* FindBucket(const int s, const uint64_t key)const;
+		void SearchTable(const int s, const uint64_t target, const int sub_radius,
+						 const int radius, std::vector<hf_t> &results)const;
+
+	public:
+		/* n_substrings in 1..HF_MAX_SUBSTRINGS; throws std::invalid_argument otherwise */
+		HFMultiIndex(const int n_substrings=4);
+
+		void Insert(const hf_t &item);
+
+		void Delete(const hf_t &item);
+
+		std::vector<hf_t> RangeSearch(const uint64_t target, const int radius)const;
+
+		size_t Size()const;
+
+		void Clear();
+
+		size_t MemoryUsage()const;
+	};
+}
+
+#endif /* _HFMULTI_H */
@@ -20,13 +20,30 @@
 #ifndef _HFNODE_H
 #define _HFNODE_H
 
+#include <array>
 #include <vector>
 #include <queue>
 #include <stack>
 #include "hft/hft.hpp"
 
+#define HF_PACKED_INLINE 16
+
 namespace hft {
 
+	/**
+	 *  Child indices of a node ordered by their distance to each index.
+	 *  The children at distance d from idx are
+	 *  children[idx][offsets[idx][d]] .. children[idx][offsets[idx][d+1]-1]
+	 **/
+	struct hf_neighbors_t {
+		std::array<std::array<std::uint8_t, NODE_FANOUT>, NODE_FANOUT> children;
+		std::array<std::array<std::uint8_t, CHUNKSIZE+2>, NODE_FANOUT> offsets;
+	};
+
+	extern const hf_neighbors_t hf_neighbors;
+
+	class HFLeafStore;
+
 	class HFNode {
 	public:
 		virtual ~HFNode();
@@ -39,6 +56,7 @@ namespace hft {
 	class HFInternal : public HFNode {
 	private:
 		HFNode* m_nodes[NODE_FANOUT];
+		uint32_t m_occupied;
 	public:
 		HFInternal();
 		~HFInternal();
@@ -48,29 +66,143 @@ namespace hft {
 		
 		void SetChildNode(HFNode *node, const int idx);
 		bool HasChildNode(const std::uint64_t idx)const;
-		HFNode* GetChildNode(const std::uint64_t idx);
+		HFNode* GetChildNode(const std::uint64_t idx, const bool packed=false, HFLeafStore *store=NULL);
 		void GetChildNodes(std::queue<HFNode*> &nodes)const;
+		int NumChildNodes()const;
 		void SearchFast(const std::uint64_t target, const std::uint64_t target_idx,
 					const int level, const int radius, std::queue<hf_search_t> &nodes);
 		void Search(const std::uint64_t target, const std::uint64_t target_idx,
 					const int level, const int radius, std::queue<hf_search_t> &nodes);
+
+		/* Search (or SearchFast) for a query radius of at most R, unrolled at compile time */
+		template<int R, bool FAST>
+		void SearchKernel(const std::uint64_t target_idx, const int level, const int radius,
+						  std::queue<hf_search_t> &nodes)const;
 	};
 
+	template<int R, bool FAST>
+	void HFInternal::SearchKernel(const std::uint64_t target_idx, const int level, const int radius,
+								  std::queue<hf_search_t> &nodes)const{
+		constexpr int max_d = FAST ? ((R < 1) ? R : 1) : ((R < CHUNKSIZE) ? R : CHUNKSIZE);
+		if (!FAST && R >= CHUNKSIZE && radius >= CHUNKSIZE){
+			for (std::uint32_t bits = m_occupied;bits != 0;bits &= bits-1){
+				int i = __builtin_ctz(bits);
+				nodes.push({ m_nodes[i], level+1, radius - __builtin_popcountll(target_idx^i) });
+			}
+			return;
+		}
+
+		const std::uint8_t *children = hf_neighbors.children[target_idx].data();
+		const std::uint8_t *offsets = hf_neighbors.offsets[target_idx].data();
+#pragma GCC unroll 8
+		for (int d=0;d <= max_d;d++){
+			if (d > radius) break;
+			for (int j=offsets[d];j < offsets[d+1];j++){
+				if (m_occupied & (0x01U << children[j])){
+					nodes.push({ m_nodes[children[j]], level+1, radius - d });
+				}
+			}
+		}
+	}
+
 	class HFLeaf : public HFNode {
+	public:
+		bool IsLeaf()const;
+
+		virtual void Add(const hf_t &item, const int level) = 0;
+		virtual void GetEntries(std::vector<hf_t> &entries, const int level)const = 0;
+		virtual void Search(const std::uint64_t target, const std::uint64_t target_idx,
+							const int level, const int radius, std::vector<hf_t> &results,
+							std::vector<int> *distances=NULL) = 0;
+		virtual void Delete(const hf_t &item, const int level) = 0;
+
+		/* release unused storage */
+		virtual void Shrink() = 0;
+
+		/* a leaf in store if given, else packed or not */
+		static HFLeaf* Create(const bool packed, HFLeafStore *store=NULL);
+	};
+
+	class HFListLeaf : public HFLeaf {
 	private:
 		std::vector<hf_t> m_entries;
 	public:
-		HFLeaf();
-		~HFLeaf();
-		bool IsLeaf()const;
+		HFListLeaf();
+		~HFListLeaf();
 		std::size_t Size()const;
 		std::size_t nbytes()const;
 	
 		void Add(const hf_t &item, const int level);
-		const std::vector<hf_t>& GetEntries()const;
+		void GetEntries(std::vector<hf_t> &entries, const int level)const;
+		void Search(const std::uint64_t target, const std::uint64_t target_idx,
+					const int level, const int radius, std::vector<hf_t> &results,
+					std::vector<int> *distances=NULL);
+		void Delete(const hf_t &item, const int level);
+		void Shrink();
+	};
+
+	/**
+	 * Leaf that only keeps the code bits below its level, since the prefix is
+	 * shared by every entry, in the narrowest whole number of bytes.  Entries
+	 * are kept in id order, with the ids stored as varint deltas.  Small leaves
+	 * are stored inline, without a separate allocation.
+	 **/
+	class HFPackedLeaf : public HFLeaf {
+	private:
+		std::uint64_t m_prefix;
+		union {
+			std::uint8_t *m_data;
+			std::uint8_t m_inline[HF_PACKED_INLINE];
+		};
+		std::uint32_t m_count;
+		std::uint32_t m_nbytes;
+
+		const std::uint8_t* Data()const;
+	public:
+		HFPackedLeaf();
+		~HFPackedLeaf();
+		std::size_t Size()const;
+		std::size_t nbytes()const;
+
+		/* replace the contents of the leaf with entries (reordered by id) */
+		void Encode(std::vector<hf_t> &entries, const int level);
+
+		void Add(const hf_t &item, const int level);
+		void GetEntries(std::vector<hf_t> &entries, const int level)const;
+		void Search(const std::uint64_t target, const std::uint64_t target_idx,
+					const int level, const int radius, std::vector<hf_t> &results,
+					std::vector<int> *distances=NULL);
+		void Delete(const hf_t &item, const int level);
+		void Shrink();
+	};
+
+	/**
+	 * Leaf whose entries live in an extent of a HFLeafStore, so that only the
+	 * location and count of the entries are kept in memory.  Every change
+	 * rewrites the extent.
+	 **/
+	class HFStoredLeaf : public HFLeaf {
+	private:
+		HFLeafStore *m_store;
+		std::uint64_t m_offset;
+		std::uint32_t m_count;
+		std::uint32_t m_capacity;
+	public:
+		HFStoredLeaf(HFLeafStore *store);
+		~HFStoredLeaf();
+		std::size_t Size()const;
+		std::size_t nbytes()const;
+
+		/* replace the contents of the leaf with entries */
+		void Encode(const std::vector<hf_t> &entries);
+
+		void Add(const hf_t &item, const int level);
+		void GetEntries(std::vector<hf_t> &entries, const int level)const;
 		void Search(const std::uint64_t target, const std::uint64_t target_idx,
-					const int level, const int radius, std::vector<hf_t> &results);
+					const int level, const int radius, std::vector<hf_t> &results,
+					std::vector<int> *distances=NULL);
 		void Delete(const hf_t &item, const int level);
+		void Shrink();
 	};
 }
 
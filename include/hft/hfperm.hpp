@@ -0,0 +1,72 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFPERM_H
+#define _HFPERM_H
+
+#include <vector>
+#include <istream>
+#include <ostream>
+#include "hft/hft.hpp"
+
+namespace hft {
+
+	/**
+	 * Bit permutation applied to codes before they are routed through the trie.
+	 * Bit j of the permuted key (counting from the msb) is bit m_order[j] of the
+	 * original code.  Hamming distance is invariant under the permutation.
+	 **/
+	class HFPermutation {
+	private:
+		int m_order[NDIMS];
+		std::vector<uint64_t> m_fwd;
+		std::vector<uint64_t> m_inv;
+
+		void BuildTables();
+
+	public:
+		HFPermutation();
+
+		/**
+		 * order[j] is the position (from the msb) of the code bit moved to position j.
+		 * Must be a permutation of 0..NDIMS-1.
+		 **/
+		HFPermutation(const int order[NDIMS]);
+
+		/**
+		 * Learn an ordering from a sample of codes: highest entropy bits first,
+		 * greedily skipping bits that are correlated with those already chosen.
+		 **/
+		static HFPermutation Learn(const std::vector<hf_t> &sample);
+
+		bool IsIdentity()const;
+
+		uint64_t Apply(const uint64_t code)const;
+
+		uint64_t Invert(const uint64_t key)const;
+
+		const int* GetOrder()const;
+
+		void Write(std::ostream &ostrm)const;
+
+		void Read(std::istream &istrm);
+	};
+}
+
+#endif /* _HFPERM_H */
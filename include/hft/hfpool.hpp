@@ -0,0 +1,73 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFPOOL_H
+#define _HFPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hft {
+
+	/**
+	 * Fixed set of worker threads for data parallel loops.  Tasks of a
+	 * ParallelFor are claimed one at a time from a shared cursor, so idle workers
+	 * keep pulling work from busy ones until the loop is drained.  The calling
+	 * thread takes part as the last worker.
+	 **/
+	class HFThreadPool {
+	private:
+		std::vector<std::thread> m_threads;
+		std::mutex m_mutex;
+		std::condition_variable m_start;
+		std::condition_variable m_done;
+
+		const std::function<void(size_t, int)> *m_fn;
+		size_t m_ntasks;
+		std::atomic<size_t> m_next;
+		unsigned long m_generation;
+		int m_active;
+		bool m_stop;
+
+		void WorkerLoop(const int worker);
+		void RunTasks(const int worker);
+
+	public:
+		/* n_threads <= 0 selects the hardware concurrency */
+		HFThreadPool(const int n_threads=0);
+		~HFThreadPool();
+		HFThreadPool(const HFThreadPool &other) = delete;
+		HFThreadPool& operator=(const HFThreadPool &other) = delete;
+
+		/* number of workers, including the calling thread */
+		int Size()const;
+
+		/**
+		 * Run fn(task, worker) for task in [0, n_tasks) and wait for completion.
+		 * worker is in [0, Size()).  Not reentrant.
+		 **/
+		void ParallelFor(const size_t n_tasks, const std::function<void(size_t, int)> &fn);
+	};
+}
+
+#endif /* _HFPOOL_H */
@@ -0,0 +1,104 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFPROTO_H
+#define _HFPROTO_H
+
+#include <string>
+#include <vector>
+#include "hft/hft.hpp"
+
+#define HF_MAX_MESSAGE (64*1024*1024)
+
+/* most entries that fit in one response */
+#define HF_MAX_RESULTS ((HF_MAX_MESSAGE - 8)/16)
+
+namespace hft {
+
+	/**
+	 * Compact binary protocol between HFServer and HFClient.
+	 * Every message is a fixed header followed by length bytes of payload,
+	 * in host byte order (the transport is local).
+	 * Requests carry (id, code, param) where param is the radius or k.
+	 * Responses carry a count followed by count entries for the search types.
+	 * A search with more than HF_MAX_RESULTS results is answered with
+	 * HF_STATUS_TOOMANY and the count alone.
+	 **/
+	enum hf_msg_type_t : uint8_t {
+		HF_MSG_INSERT = 1,
+		HF_MSG_DELETE,
+		HF_MSG_RANGE,
+		HF_MSG_RANGEFAST,
+		HF_MSG_KNN,
+		HF_MSG_COUNT
+	};
+
+	enum hf_status_t : uint8_t {
+		HF_STATUS_OK = 0,
+		HF_STATUS_BADREQUEST,
+		HF_STATUS_TOOMANY
+	};
+
+	struct hf_msg_header_t {
+		uint32_t length;
+		uint32_t req_id;
+		uint8_t type;
+		uint8_t status;
+		uint16_t reserved;
+	};
+
+	struct hf_request_t {
+		uint32_t req_id;
+		uint8_t type;
+		long long id;
+		uint64_t code;
+		int32_t param;
+		hf_request_t():req_id(0),type(0),id(0),code(0),param(0){}
+		hf_request_t(const uint8_t type, const long long id, const uint64_t code, const int32_t param)
+			:req_id(0),type(type),id(id),code(code),param(param){}
+	};
+
+	struct hf_response_t {
+		uint32_t req_id;
+		uint8_t type;
+		uint8_t status;
+		uint64_t count;
+		std::vector<hf_t> results;
+		hf_response_t():req_id(0),type(0),status(HF_STATUS_OK),count(0){}
+	};
+
+	/* true if responses of this type carry entries */
+	bool HasResults(const uint8_t type);
+
+	void EncodeRequest(const hf_request_t &req, std::string &buf);
+
+	/* throws std::invalid_argument if resp holds more than HF_MAX_RESULTS entries */
+	void EncodeResponse(const hf_response_t &resp, std::string &buf);
+
+	/**
+	 * Decode one message from the front of data.  Returns the number of bytes
+	 * consumed, or 0 if data does not yet hold a complete message.
+	 * Throws std::runtime_error on a malformed message.
+	 **/
+	size_t DecodeRequest(const char *data, const size_t len, hf_request_t &req);
+
+	size_t DecodeResponse(const char *data, const size_t len, hf_response_t &resp);
+}
+
+#endif /* _HFPROTO_H */
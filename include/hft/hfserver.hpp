@@ -0,0 +1,102 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFSERVER_H
+#define _HFSERVER_H
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hft/hftrie.hpp"
+#include "hft/hfproto.hpp"
+#include "hft/hfpool.hpp"
+
+namespace hft {
+
+	/**
+	 * Serves an HFTrie over a unix domain socket or loopback tcp.
+	 * A single epoll loop reads every request that is ready, then runs them as one
+	 * batch: consecutive reads are spread over the worker pool, writes are applied
+	 * in between by the loop thread.  Each connection sees its requests applied and
+	 * answered in the order they were sent.
+	 **/
+	class HFServer {
+	private:
+		struct connection_t {
+			int fd;
+			std::string in;
+			size_t in_pos;
+			std::string out;
+			size_t out_pos;
+			bool closed;
+			bool writing;
+		};
+
+		struct pending_t {
+			connection_t *conn;
+			hf_request_t req;
+		};
+
+		HFTrie &m_trie;
+		HFThreadPool m_pool;
+		int m_listen_fd;
+		int m_epoll_fd;
+		int m_wake_fd;
+		std::string m_unix_path;
+		std::atomic<bool> m_stop;
+		std::atomic<size_t> m_max_results;
+		std::unordered_map<int, connection_t*> m_conns;
+
+		void AddListener(const int fd);
+		void Accept();
+		void ReadConnection(connection_t *conn, std::vector<pending_t> &batch);
+		void FlushConnection(connection_t *conn);
+		void CloseConnection(connection_t *conn);
+		void Execute(const hf_request_t &req, hf_response_t &resp);
+		void ExecuteBatch(std::vector<pending_t> &batch);
+
+	public:
+		/* n_workers <= 0 selects the hardware concurrency */
+		HFServer(HFTrie &trie, const int n_workers=0);
+		~HFServer();
+		HFServer(const HFServer &other) = delete;
+		HFServer& operator=(const HFServer &other) = delete;
+
+		/* throws std::runtime_error if the socket cannot be bound */
+		void ListenUnix(const std::string &path);
+
+		/* listen on 127.0.0.1; port 0 picks a free port. Returns the bound port. */
+		int ListenTCP(const int port);
+
+		/**
+		 * Searches with more than n results (at most HF_MAX_RESULTS) are answered
+		 * with HF_STATUS_TOOMANY and the count only.
+		 **/
+		void SetMaxResults(const size_t n);
+
+		/* serve until Stop() is called */
+		void Run();
+
+		/* safe to call from another thread or a signal handler */
+		void Stop();
+	};
+}
+
+#endif /* _HFSERVER_H */
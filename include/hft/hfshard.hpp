@@ -0,0 +1,101 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFSHARD_H
+#define _HFSHARD_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "hft/hfclient.hpp"
+
+/* codes are assigned to shards by this many leading bits */
+#define HF_SHARD_PREFIX_BITS 8
+#define HF_MAX_SHARDS (1 << HF_SHARD_PREFIX_BITS)
+
+namespace hft {
+
+	/* receives the results of one shard as soon as they arrive */
+	typedef std::function<void(const int shard, const std::vector<hf_t> &results)> hf_shard_fn;
+
+	/* merged answer of the shards a query was sent to */
+	struct hf_gather_t {
+		std::vector<hf_t> results;
+		uint64_t count;
+		int n_shards;
+		int n_timeouts;
+		hf_gather_t():count(0),n_shards(0),n_timeouts(0){}
+
+		/* false if some shard missed the deadline, so results are partial */
+		bool Complete()const { return n_timeouts == 0; }
+	};
+
+	/**
+	 * Coordinator over HFServer shard processes, each owning an equal range of
+	 * the leading HF_SHARD_PREFIX_BITS bits of the code space.  Inserts and
+	 * deletes go to the owning shard.  Queries go only to the shards owning a
+	 * prefix within radius of the target, all at once, and their responses are
+	 * gathered in arrival order until the timeout.  A shard that misses it is
+	 * counted in n_timeouts, and its late response is discarded by the next query.
+	 * All shards must be added before the first insert.
+	 * Throws std::runtime_error on connection errors.
+	 **/
+	class HFCoordinator {
+	private:
+		std::vector<HFClient*> m_shards;
+		int m_timeout_ms;
+
+		std::vector<int> Reachable(const uint64_t target, const int radius)const;
+		hf_gather_t Gather(const uint8_t type, const uint64_t target, const int param,
+						   const std::vector<int> &shards, const hf_shard_fn &emit);
+
+	public:
+		HFCoordinator();
+		~HFCoordinator();
+		HFCoordinator(const HFCoordinator &other) = delete;
+		HFCoordinator& operator=(const HFCoordinator &other) = delete;
+
+		/* throws std::invalid_argument beyond HF_MAX_SHARDS */
+		void AddShardUnix(const std::string &path);
+
+		void AddShardTCP(const int port, const std::string &host="127.0.0.1");
+
+		int NumShards()const;
+
+		int ShardOf(const uint64_t code)const;
+
+		/* deadline for each shard to answer a query, from when it is sent (-1 for none) */
+		void SetTimeout(const int timeout_ms);
+
+		void Insert(const hf_t &item);
+
+		void Delete(const hf_t &item);
+
+		hf_gather_t RangeSearch(const uint64_t target, const int radius, const hf_shard_fn &emit=hf_shard_fn());
+
+		hf_gather_t RangeSearchFast(const uint64_t target, const int radius, const hf_shard_fn &emit=hf_shard_fn());
+
+		/* the k nearest of the k nearest from every shard, nearest first */
+		hf_gather_t KNearestSearch(const uint64_t target, const int k);
+
+		hf_gather_t Count(const uint64_t target, const int radius);
+	};
+}
+
+#endif /* _HFSHARD_H */
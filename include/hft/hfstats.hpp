@@ -0,0 +1,60 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFSTATS_H
+#define _HFSTATS_H
+
+#include <string>
+#include <vector>
+#include "hft/hft.hpp"
+
+/* level at which subtrees are sampled */
+#define HF_STATS_SAMPLE_LEVEL 2
+
+namespace hft {
+
+	/**
+	 * Shape of a HFTrie.  Per-level vectors are indexed by level (depth from the
+	 * root), leaf_occupancy by number of entries (the last bucket holds all leaves
+	 * over LC) and fanout by number of children.  With sampling, counts are
+	 * estimates scaled up from the sampled subtrees.
+	 **/
+	struct hf_stats_t {
+		double sample;
+		uint64_t n_entries;
+		uint64_t n_internal;
+		uint64_t n_leaves;
+		uint64_t internal_bytes;
+		uint64_t leaf_bytes;
+		std::vector<uint64_t> internal_per_level;
+		std::vector<uint64_t> leaves_per_level;
+		std::vector<uint64_t> entries_per_level;
+		std::vector<uint64_t> leaf_occupancy;
+		std::vector<uint64_t> fanout;
+
+		hf_stats_t();
+
+		/* mean leaf depth weighted by entries, i.e. the levels visited by an exact lookup */
+		double MeanDepth()const;
+
+		std::string ToJSON()const;
+	};
+}
+
+#endif /* _HFSTATS_H */
@@ -0,0 +1,127 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFSTORE_H
+#define _HFSTORE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hft/hft.hpp"
+
+#define HF_STORE_SHARDS 16
+#define HF_STORE_PAGE 4096
+#define HF_STORE_CLASSES 32
+
+/* bytes of contiguous writes gathered before they go to the file */
+#define HF_STORE_BATCH (1 << 20)
+
+/* bytes past a missed page that the kernel is asked to read ahead */
+#define HF_STORE_READAHEAD (64*1024)
+
+namespace hft {
+
+	/**
+	 * File backed storage for the entries of leaves.  Each leaf owns an extent of
+	 * the file holding a power of two number of entries; released extents are
+	 * reused by size, and new ones are appended, so leaves built in key order lie
+	 * next to their neighbors.  Pages of the file that were recently read are kept
+	 * in memory up to a budget of bytes, split into shards with a CLOCK replacement
+	 * policy each.  A missed page is read with pread, and the kernel is asked to
+	 * read ahead the pages that follow.  Contiguous writes are gathered into one
+	 * pwrite.  The file is unlinked once opened, so it only lives as long as the
+	 * store.  Reads are safe from any thread; writes, allocations and releases
+	 * must not run concurrently with other calls.
+	 **/
+	class HFLeafStore {
+	private:
+		struct slot_t {
+			uint64_t page;
+			std::vector<char> data;
+			bool referenced;
+		};
+
+		struct alignas(64) shard_t {
+			std::mutex mutex;
+			std::unordered_map<uint64_t, size_t> index;
+			std::vector<slot_t> slots;
+			size_t hand;
+		};
+
+		int m_fd;
+		size_t m_pages_per_shard;
+		shard_t *m_shards;
+		uint64_t m_end;
+		size_t m_live;
+		std::vector<uint64_t> m_free[HF_STORE_CLASSES];
+		uint64_t m_pending_offset;
+		std::vector<char> m_pending;
+		std::atomic<uint64_t> m_reads;
+		std::atomic<uint64_t> m_misses;
+
+		shard_t& ShardOf(const uint64_t page)const;
+
+		/* copy the part of the page at page into data, reading it in if needed */
+		void ReadPage(const uint64_t page, const size_t start, const size_t nbytes, char *data);
+
+		void Flush();
+
+		/* forget all extents, once none is in use */
+		void Reset();
+
+	public:
+		/**
+		 * Store in a new file at path keeping up to budget bytes of pages in memory.
+		 * Throws std::runtime_error if the file cannot be created.
+		 **/
+		HFLeafStore(const std::string &path, const size_t budget);
+		~HFLeafStore();
+		HFLeafStore(const HFLeafStore &other) = delete;
+		HFLeafStore& operator=(const HFLeafStore &other) = delete;
+
+		/* number of entries of the smallest extent that holds n */
+		static uint32_t Capacity(const size_t n);
+
+		/* offset of an extent for capacity entries, a value returned by Capacity */
+		uint64_t Allocate(const uint32_t capacity);
+
+		void Release(const uint64_t offset, const uint32_t capacity);
+
+		/* write the n entries of the extent at offset */
+		void Write(const uint64_t offset, const hf_t *entries, const size_t n);
+
+		/* append the n entries of the extent at offset */
+		void Read(const uint64_t offset, const size_t n, std::vector<hf_t> &entries);
+
+		/* pages read, and those read from the file */
+		uint64_t Reads()const;
+		uint64_t Misses()const;
+
+		/* bytes of pages held in memory */
+		size_t Resident()const;
+
+		uint64_t FileSize()const;
+
+		size_t MemoryUsage()const;
+	};
+}
+
+#endif /* _HFSTORE_H */
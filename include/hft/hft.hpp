@@ -19,7 +19,12 @@
 
 #ifndef _HF_H
 #define _HF_H
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
 
 
 #define NDIMS 64
@@ -27,18 +32,31 @@
 #define NODE_FANOUT 16
 #define LC 10
 
+/* id stored with each code, any integral type (e.g. uint32_t for 12 byte entries) */
+#ifndef HFT_ID_TYPE
+#define HFT_ID_TYPE long long
+#endif
+
 namespace hft {
 
+	typedef HFT_ID_TYPE hf_id_t;
+
+	static_assert(std::is_integral<hf_id_t>::value, "HFT_ID_TYPE must be an integral type");
+
+	/* packed to 4 byte alignment, so 32-bit ids give 12 byte entries */
+#pragma pack(push, 4)
 	struct hf_t {
-		static unsigned long n_ops;
-		long long id;
+		/* distance computations, counted from any thread */
+		static std::atomic<unsigned long> n_ops;
+		hf_id_t id;
 		uint64_t code;
 		hf_t():id(0),code(0){};
-		hf_t(const long long id, const uint64_t code):id(id),code(code){}
-		hf_t(const hf_t &other);
-		hf_t& operator=(const hf_t &other);
+		hf_t(const hf_id_t id, const uint64_t code):id(id),code(code){}
 		int hdistance(const uint64_t c)const;
 	};
+#pragma pack(pop)
+
+	static_assert(std::is_trivially_copyable<hf_t>::value, "hf_t must be trivially copyable");
 
 	class HFNode;
 
@@ -47,14 +65,39 @@ namespace hft {
 		int lvl;
 		int r;
 		hf_search_t(const HFNode *node,const int lvl, const int r):node(node),lvl(lvl),r(r){}
-		hf_search_t(const hf_search_t &other);
-		hf_search_t& operator=(const hf_search_t &other);
 	};
 
 	uint64_t create_mask(const int level);
 
 	uint64_t extract_index(const uint64_t code, const int level);
 
+	/* stable counting sort of results and distances from start on by increasing distance */
+	void sort_by_distance(std::vector<hf_t> &results, std::vector<int> &distances, const size_t start);
+
+	/**
+	 * k nearest by widening the radius until search(radius, results, distances)
+	 * yields at least k entries.  search must append its results sorted by
+	 * distance, as the range searches do with sorted=true.
+	 **/
+	template<typename search_fn>
+	std::vector<hf_t> knearest_search(const size_t k, const search_fn &search){
+		std::vector<hf_t> results;
+		if (k == 0) return results;
+
+		std::vector<int> distances;
+		int radius = 0;
+		while (true){
+			results.clear();
+			distances.clear();
+			search(radius, results, distances);
+			if (results.size() >= k || radius >= NDIMS) break;
+			radius = (radius == 0) ? 1 : std::min(2*radius, NDIMS);
+		}
+
+		if (results.size() > k) results.resize(k);
+		return results;
+	}
+
 }
 
 #endif /* _HF_H */
@@ -19,37 +19,351 @@
 
 #ifndef _HFTRIE_H
 #define _HFTRIE_H
+#include <functional>
+#include <istream>
 #include <ostream>
+#include <string>
 #include <vector>
 #include <queue>
 #include "hft/hfnode.hpp"
+#include "hft/hfcodetable.hpp"
+#include "hft/hfcache.hpp"
+#include "hft/hfperm.hpp"
+#include "hft/hfmetrics.hpp"
+#include "hft/hfpool.hpp"
+#include "hft/hfstats.hpp"
+#include "hft/hfstore.hpp"
+
+/* widest root table, in bits of the key */
+#define HF_ROOT_MAX_BITS 16
+
+/* select the root table depth from the density of the top levels */
+#define HF_ROOT_AUTO -1
 
 namespace hft {
 
+	/* node that holds the subtree of a root table slot, and its level */
+	struct hf_root_slot_t {
+		const HFNode *node;
+		int lvl;
+	};
+
+	/* receives a matching pair of entries and their distance */
+	typedef std::function<void(const hf_t &a, const hf_t &b, const int distance)> hf_pair_fn;
+
+	/**
+	 * Limits on one call of a bounded search, 0 for no limit: wall clock time in
+	 * microseconds, and ops, counted as one per internal node expanded and one per
+	 * leaf entry compared.
+	 **/
+	struct hf_bounds_t {
+		long long max_usecs;
+		size_t max_ops;
+	};
+
+	/**
+	 * Rest of a bounded search: the subtrees still to visit, held by key prefix
+	 * and level rather than by node, so that it stays valid across inserts and deletes.
+	 **/
+	class HFContinuation {
+	private:
+		struct pending_t {
+			uint64_t prefix;
+			int lvl;
+			int r;
+		};
+
+		uint64_t m_target;
+		int m_radius;
+		bool m_fast;
+		int m_order[NDIMS];
+		std::vector<pending_t> m_pending;
+
+		friend class HFTrie;
+	public:
+		HFContinuation();
+
+		/* whether every subtree has been visited */
+		bool Done()const;
+
+		/* number of subtrees still to visit */
+		size_t Pending()const;
+	};
+
 	class HFTrie {
 	private:
 		HFNode *m_top;
+		HFPermutation m_perm;
+		HFMetrics *m_metrics;
+		size_t m_internal_nodes[NDIMS/CHUNKSIZE + 1];
+		bool m_packed;
+		uint64_t m_compact_cursor;
+		int m_compact_level;
+
+		bool m_flat_enabled;
+		std::vector<uint64_t> m_flat_codes;
+		std::vector<hf_id_t> m_flat_ids;
+
+		bool m_exact_enabled;
+		HFCodeTable m_exact;
+
+		HFResultCache *m_cache;
+
+		HFLeafStore *m_store;
+
+		int m_root_bits;
+		int m_root_level;
+		std::vector<hf_root_slot_t> m_root_table;
+
+		void CollectEntries(std::vector<hf_t> &entries)const;
+
+		/* replace the contents with all, given in code space; reorders all */
+		void Build(std::vector<hf_t> &all, const bool learn_permutation);
+
+		void ToCodeSpace(std::vector<hf_t> &results, const size_t start=0)const;
+
+		void CountNodes();
+		int AutoRootLevel()const;
+		void BuildRootTable();
+		void FillRootTable(const HFNode *node, const int level, const uint64_t prefix);
+		/* node now sits at level under the prefix of level chunks (NULL if removed) */
+		void UpdateRootTable(const HFNode *node, const int level, const uint64_t prefix);
+		/* visit the subtrees of cont until done or out of bounds; returns whether done */
+		bool SearchBounded(HFContinuation &cont, const hf_bounds_t &bounds, std::vector<hf_t> &results)const;
+
+		/* push the nodes a search for target within radius starts from */
+		void SeedSearch(const uint64_t target, const int radius, const bool fast,
+						std::queue<hf_search_t> &nodes)const;
+
+		HFNode* Collapse(HFInternal *internal, const int level);
+
+		HFNode* CompactNode(HFNode *node, const int level, const uint64_t prefix, size_t &budget, bool &stopped);
+
+		/* appends cached results; otherwise stamp receives the time to cache fresh results under */
+		bool FromCache(const uint64_t code, const uint64_t target, const int radius, const hf_cache_mode_t mode,
+					   std::vector<hf_t> &results, uint64_t &stamp)const;
+		double EstimateSearchCost(const int radius)const;
+
+		void FlatScan(const uint64_t target, const int radius, HFThreadPool *pool,
+					  std::vector<hf_t> &results)const;
 
 	public:
 		HFTrie();
 
 		~HFTrie();
 
+		HFTrie(const HFTrie &other) = delete;
+
+		HFTrie& operator=(const HFTrie &other) = delete;
+
 		void Insert(const hf_t &item);
 
+		/**
+		 * Add a batch of entries by rebuilding the whole index bottom up from the
+		 * sorted keys of all entries, existing and new.  Each call costs O(N) in the
+		 * total size, so it is meant for initial loads and large batches; use
+		 * Insert for small ones.  If learn_permutation is set, a bit permutation
+		 * is first learned from all entries.
+		 **/
+		void BulkLoad(const std::vector<hf_t> &entries, const bool learn_permutation=false);
+
+		/* same, building in place from the storage of entries, which is left empty */
+		void BulkLoad(std::vector<hf_t> &&entries, const bool learn_permutation=false);
+
+		/**
+		 * Replace the bit permutation applied to codes, rebuilding existing entries.
+		 **/
+		void SetPermutation(const HFPermutation &perm);
+
+		const HFPermutation& GetPermutation()const;
+
+		/**
+		 * Store leaves in packed form: only the code bits below the leaf prefix,
+		 * and ids as varint deltas.  Inserts and deletes then re-encode the leaf.
+		 * Rebuilds existing entries.
+		 **/
+		void EnableCompression(const bool enable);
+
+		/**
+		 * Keep the internal nodes in memory but move the entries of all leaves into
+		 * a file at path (on local flash, say), holding up to resident_bytes of
+		 * recently used leaves in memory.  Leaves are then stored uncompressed.
+		 * An empty path brings all leaves back into memory.  Rebuilds existing
+		 * entries.  Throws std::runtime_error if the file cannot be created.
+		 **/
+		void EnableTiering(const std::string &path, const size_t resident_bytes);
+
+		/* the leaf store in use, NULL unless tiering is enabled */
+		const HFLeafStore* GetStore()const;
+
+		/**
+		 * Remove all entries equal to item.  Emptied leaves are freed, and an
+		 * internal node whose children are all leaves holding no more than LC/2
+		 * entries between them is merged back into one leaf.
+		 **/
 		void Delete(const hf_t &item);
+
+		/**
+		 * Release unused leaf storage and rebuild every subtree that fits in a
+		 * single leaf.  Visits at most budget nodes (0 for no limit) in key order;
+		 * the next call resumes where the last one stopped.  Returns true once
+		 * a full pass over the trie has completed.
+		 **/
+		bool Compact(const size_t budget=0);
 	
+		/**
+		 * Index the nodes at depth bits/CHUNKSIZE through a direct table of 2^bits
+		 * slots, so that searches start from the slots within radius instead of
+		 * walking the dense top levels one 4 bit chunk at a time.  bits is a multiple
+		 * of CHUNKSIZE up to HF_ROOT_MAX_BITS, 0 for no table, or HF_ROOT_AUTO to
+		 * index down to the deepest level at which at least half of all possible
+		 * internal nodes exist.  Throws std::invalid_argument otherwise.
+		 * Writes only refill the slots under the node they replace.  In auto mode
+		 * the table is rebuilt deeper once the next level is half full, and
+		 * shallower once its own level falls below a quarter.
+		 **/
+		void SetRootBits(const int bits);
+
+		/* width of the root table in use, 0 if none */
+		int GetRootBits()const;
+
 		std::vector<hf_t> RangeSearchFast(const uint64_t target, const int radius)const;
 
 		std::vector<hf_t> RangeSearch(const uint64_t target, const int radius)const;
 
+		/**
+		 * Variants that also return the distance of each result to target.
+		 * Results and distances are appended in parallel to the given vectors.
+		 * If sorted, the appended results are ordered by increasing distance.
+		 **/
+		void RangeSearchFast(const uint64_t target, const int radius, std::vector<hf_t> &results,
+							 std::vector<int> &distances, const bool sorted=false)const;
+
+		void RangeSearch(const uint64_t target, const int radius, std::vector<hf_t> &results,
+						 std::vector<int> &distances, const bool sorted=false)const;
+
+		/**
+		 * Exact range search counting only the bits set in care_mask, so codes that
+		 * differ from target in the other bits alone are at distance 0.  Chunks with
+		 * no cared bits expand all of their children without using up radius.
+		 **/
+		std::vector<hf_t> RangeSearchMasked(const uint64_t target, const uint64_t care_mask, const int radius)const;
+
+		/**
+		 * Range search (exact, or as RangeSearchFast if fast) that stops once bounds
+		 * are reached, appending the results found so far and leaving the rest of the
+		 * search in cont.  Returns true once the search is complete.  A call visits at
+		 * least one node and finishes any leaf it starts, so it may overrun its bounds
+		 * by one leaf.  Entries written between calls may or may not be found.
+		 **/
+		bool RangeSearchBounded(const uint64_t target, const int radius, const hf_bounds_t &bounds,
+								std::vector<hf_t> &results, HFContinuation &cont, const bool fast=false)const;
+
+		/**
+		 * Continue the search of cont, appending the next results.  Throws
+		 * std::invalid_argument if the permutation has changed since it started.
+		 **/
+		bool Resume(HFContinuation &cont, const hf_bounds_t &bounds, std::vector<hf_t> &results)const;
+
+		/**
+		 * Exact range search with the subtrees below the first few levels of the
+		 * frontier spread over the workers of pool.  Same results as RangeSearch.
+		 **/
+		std::vector<hf_t> RangeSearchParallel(const uint64_t target, const int radius, HFThreadPool &pool)const;
+
+		/**
+		 * The k entries closest to target, nearest first, found with exact range
+		 * searches of doubling radius.
+		 **/
+		std::vector<hf_t> KNearestSearch(const uint64_t target, const size_t k)const;
+
+		/**
+		 * Keep a flat array of all codes alongside the trie so that large radius
+		 * queries can be answered with a vectorized linear scan.  Costs 16 bytes
+		 * per entry, and Delete must then also search the array.
+		 **/
+		void EnableFlatScan(const bool enable);
+
+		/**
+		 * Keep a hash table from codes to entries alongside the trie, so that
+		 * radius 0 searches (and the batched lookups below) cost about one cache
+		 * miss instead of a root to leaf walk.  Costs 32 bytes per entry.
+		 **/
+		void EnableExactTable(const bool enable);
+
+		/* whether any entry has exactly code */
+		bool Contains(const uint64_t code)const;
+
+		/* batched exact lookups, prefetching ahead through the table when it is enabled */
+		std::vector<bool> Contains(const std::vector<uint64_t> &codes)const;
+
+		std::vector<std::vector<hf_t>> Lookup(const std::vector<uint64_t> &codes)const;
+
+		/**
+		 * Exact range search that estimates the cost of a trie traversal from
+		 * the radius, the index size and the number of internal nodes per level,
+		 * and runs the flat scan instead when that is cheaper.  The scan is spread
+		 * over pool if one is given.  Without the flat array this is RangeSearch.
+		 **/
+		std::vector<hf_t> RangeSearchAuto(const uint64_t target, const int radius, HFThreadPool *pool=NULL)const;
+
+		/**
+		 * All pairs (a, b), a from this trie and b from other, within radius of
+		 * each other.  Both tries are traversed together, pairing only subtrees
+		 * whose prefixes are within radius.  Both must use the same permutation,
+		 * else std::invalid_argument is thrown.  With a pool, the subtree pairs
+		 * are spread over its workers and emit is called concurrently.
+		 **/
+		void SimilarityJoin(const HFTrie &other, const int radius, const hf_pair_fn &emit,
+							HFThreadPool *pool=NULL)const;
+
+		/* all pairs of entries of this trie within radius, each emitted once */
+		void SelfJoin(const int radius, const hf_pair_fn &emit, HFThreadPool *pool=NULL)const;
+
 		size_t Size()const;
 
+		/* O(1), unlike Size() */
+		bool Empty()const;
+
 		void Clear();
 	
 		size_t MemoryUsage()const;
 
 		void Print(std::ostream &ostrm)const;
+
+		/**
+		 * Shape of the trie, from a single traversal.  With sample < 1, only that
+		 * fraction of the subtrees below HF_STATS_SAMPLE_LEVEL is visited and their
+		 * counts are scaled up accordingly.  Throws std::invalid_argument unless
+		 * 0 < sample <= 1.
+		 **/
+		hf_stats_t Stats(const double sample=1.0)const;
+
+		/**
+		 * Cache the results of up to capacity range searches (0 disables the cache).
+		 * Inserts and deletes only invalidate cached searches whose radius reaches
+		 * the subtree they write to.  KNearestSearch and RangeSearchParallel are
+		 * not cached.  GetCache() returns NULL while disabled.
+		 **/
+		void EnableCache(const size_t capacity);
+		const HFResultCache* GetCache()const;
+
+		/**
+		 * Opt-in latency histograms and structural counters.
+		 * GetMetrics() returns NULL while metrics are disabled.
+		 **/
+		void EnableMetrics(const bool enable);
+
+		const HFMetrics* GetMetrics()const;
+
+		/**
+		 * Binary serialization of the permutation, the leaf form and all entries.
+		 * Load replaces the current contents and restores packed leaves if the
+		 * index was saved with them.  Throws std::runtime_error on a bad stream.
+		 **/
+		void Save(std::ostream &ostrm)const;
+
+		void Load(std::istream &istrm);
 	
 	};
 }
@@ -0,0 +1,108 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _HFWINDOW_H
+#define _HFWINDOW_H
+
+#include <vector>
+#include "hft/hftrie.hpp"
+
+#define HF_MAX_GENERATIONS 1024
+
+namespace hft {
+
+	/**
+	 * Sliding window over a stream of entries, kept as a ring of per-generation
+	 * tries.  Inserts go to the current generation.  Advance() starts a new one,
+	 * and once the ring is full the oldest generation is retired as a whole by
+	 * detaching its trie, which costs O(1) however many entries it holds.
+	 * Retired tries are only freed by Reclaim(), so that the cost of releasing
+	 * their nodes can be paid off the ingest path.  Queries span all live
+	 * generations and deliver their results together.
+	 **/
+	class HFWindowIndex {
+	private:
+		std::vector<HFTrie*> m_ring;
+		std::vector<HFTrie*> m_retired;
+		int m_head;
+		uint64_t m_generation;
+		bool m_packed;
+
+		HFTrie* NewGeneration()const;
+
+	public:
+		/* n_generations in 1..HF_MAX_GENERATIONS; throws std::invalid_argument otherwise */
+		HFWindowIndex(const int n_generations=8);
+		~HFWindowIndex();
+		HFWindowIndex(const HFWindowIndex &other) = delete;
+		HFWindowIndex& operator=(const HFWindowIndex &other) = delete;
+
+		/* add to the current generation */
+		void Insert(const hf_t &item);
+
+		void BulkLoad(const std::vector<hf_t> &entries);
+
+		/* remove all entries equal to item from every live generation */
+		void Delete(const hf_t &item);
+
+		/**
+		 * Start a new generation, retiring the oldest one when all
+		 * n_generations are live.  Returns the number of the new generation.
+		 **/
+		uint64_t Advance();
+
+		/* free the tries of retired generations; returns the number of entries released */
+		size_t Reclaim();
+
+		/* number of the current generation, starting at 0 */
+		uint64_t Generation()const;
+
+		int NumGenerations()const;
+
+		/* the generation age steps before the current one; throws std::out_of_range */
+		const HFTrie& GetGeneration(const int age)const;
+
+		/* store the leaves of all generations in packed form (see HFTrie::EnableCompression) */
+		void EnableCompression(const bool enable);
+
+		std::vector<hf_t> RangeSearchFast(const uint64_t target, const int radius)const;
+
+		std::vector<hf_t> RangeSearch(const uint64_t target, const int radius)const;
+
+		/* results and distances are appended as with HFTrie, over all live generations */
+		void RangeSearchFast(const uint64_t target, const int radius, std::vector<hf_t> &results,
+							 std::vector<int> &distances, const bool sorted=false)const;
+
+		void RangeSearch(const uint64_t target, const int radius, std::vector<hf_t> &results,
+						 std::vector<int> &distances, const bool sorted=false)const;
+
+		std::vector<hf_t> KNearestSearch(const uint64_t target, const size_t k)const;
+
+		/* entries in live generations */
+		size_t Size()const;
+
+		/* drop all generations, including retired ones, and restart at generation 0 */
+		void Clear();
+
+		/* live and retired generations */
+		size_t MemoryUsage()const;
+	};
+}
+
+#endif /* _HFWINDOW_H */
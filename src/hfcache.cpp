@@ -0,0 +1,185 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <stdexcept>
+#include "hft/hfcache.hpp"
+
+using namespace std;
+using namespace hft;
+
+#define N_PREFIXES (1 << HF_CACHE_PREFIX_BITS)
+
+static inline int prefix_of(const uint64_t key){
+	return (int)(key >> (NDIMS - HF_CACHE_PREFIX_BITS));
+}
+
+size_t hft::HFResultCache::key_hash_t::operator()(const key_t &key)const{
+	uint64_t h = key.code ^ ((uint64_t)key.radius << 1) ^ ((uint64_t)key.mode << 8);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+hft::HFResultCache::HFResultCache(const size_t capacity){
+	if (capacity == 0) throw invalid_argument("cache capacity must be positive");
+
+	m_capacity = capacity;
+	m_shards = new shard_t[HF_CACHE_SHARDS];
+	const size_t per_shard = (capacity + HF_CACHE_SHARDS - 1)/HF_CACHE_SHARDS;
+	for (int i=0;i < HF_CACHE_SHARDS;i++){
+		m_shards[i].slots.resize(per_shard);
+		m_shards[i].hand = 0;
+		for (slot_t &slot : m_shards[i].slots){
+			slot.used = false;
+			slot.referenced = false;
+		}
+	}
+	m_clock.store(0, memory_order_relaxed);
+	for (int p=0;p < N_PREFIXES;p++){
+		m_written[p].store(0, memory_order_relaxed);
+	}
+	m_hits.store(0, memory_order_relaxed);
+	m_misses.store(0, memory_order_relaxed);
+}
+
+hft::HFResultCache::~HFResultCache(){
+	delete[] m_shards;
+}
+
+uint64_t hft::HFResultCache::Stamp()const{
+	return m_clock.load(memory_order_acquire);
+}
+
+bool hft::HFResultCache::IsCurrent(const uint64_t key, const int radius, const uint64_t stamp)const{
+	const int target = prefix_of(key);
+	for (int p=0;p < N_PREFIXES;p++){
+		if (__builtin_popcount(p ^ target) <= radius && m_written[p].load(memory_order_relaxed) > stamp)
+			return false;
+	}
+	return true;
+}
+
+bool hft::HFResultCache::Get(const uint64_t code, const uint64_t key, const int radius,
+							 const hf_cache_mode_t mode, vector<hf_t> &results){
+	const key_t k = { code, radius, mode };
+	const size_t h = key_hash_t()(k);
+	shard_t &shard = m_shards[h % HF_CACHE_SHARDS];
+	{
+		lock_guard<mutex> lock(shard.mutex);
+		auto iter = shard.index.find(k);
+		if (iter != shard.index.end()){
+			slot_t &slot = shard.slots[iter->second];
+			if (IsCurrent(key, radius, slot.stamp)){
+				slot.referenced = true;
+				results.insert(results.end(), slot.results.begin(), slot.results.end());
+				m_hits.fetch_add(1, memory_order_relaxed);
+				return true;
+			}
+		}
+	}
+	m_misses.fetch_add(1, memory_order_relaxed);
+	return false;
+}
+
+void hft::HFResultCache::Put(const uint64_t code, const int radius, const hf_cache_mode_t mode,
+							 const vector<hf_t> &results, const size_t start, const uint64_t stamp){
+	if (results.size() - start > HF_CACHE_MAX_RESULTS) return;
+
+	const key_t k = { code, radius, mode };
+	const size_t h = key_hash_t()(k);
+	shard_t &shard = m_shards[h % HF_CACHE_SHARDS];
+	lock_guard<mutex> lock(shard.mutex);
+
+	size_t pos;
+	auto iter = shard.index.find(k);
+	if (iter != shard.index.end()){
+		pos = iter->second;
+		if (shard.slots[pos].stamp > stamp) return;
+	} else {
+		// sweep the clock hand past recently referenced slots
+		while (shard.slots[shard.hand].used && shard.slots[shard.hand].referenced){
+			shard.slots[shard.hand].referenced = false;
+			shard.hand = (shard.hand + 1) % shard.slots.size();
+		}
+		pos = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.slots.size();
+		if (shard.slots[pos].used) shard.index.erase(shard.slots[pos].key);
+		shard.index[k] = pos;
+	}
+
+	slot_t &slot = shard.slots[pos];
+	slot.key = k;
+	slot.stamp = stamp;
+	slot.results.assign(results.begin() + start, results.end());
+	slot.used = true;
+	slot.referenced = false;
+}
+
+void hft::HFResultCache::Invalidate(const uint64_t key){
+	uint64_t t = m_clock.fetch_add(1, memory_order_acq_rel) + 1;
+	m_written[prefix_of(key)].store(t, memory_order_release);
+}
+
+void hft::HFResultCache::InvalidateAll(){
+	for (int i=0;i < HF_CACHE_SHARDS;i++){
+		lock_guard<mutex> lock(m_shards[i].mutex);
+		m_shards[i].index.clear();
+		for (slot_t &slot : m_shards[i].slots){
+			slot.used = false;
+			slot.referenced = false;
+			vector<hf_t>().swap(slot.results);
+		}
+		m_shards[i].hand = 0;
+	}
+	uint64_t t = m_clock.fetch_add(1, memory_order_acq_rel) + 1;
+	for (int p=0;p < N_PREFIXES;p++){
+		m_written[p].store(t, memory_order_release);
+	}
+}
+
+uint64_t hft::HFResultCache::Hits()const{
+	return m_hits.load(memory_order_relaxed);
+}
+
+uint64_t hft::HFResultCache::Misses()const{
+	return m_misses.load(memory_order_relaxed);
+}
+
+size_t hft::HFResultCache::Size()const{
+	size_t n = 0;
+	for (int i=0;i < HF_CACHE_SHARDS;i++){
+		lock_guard<mutex> lock(m_shards[i].mutex);
+		n += m_shards[i].index.size();
+	}
+	return n;
+}
+
+size_t hft::HFResultCache::MemoryUsage()const{
+	size_t n = sizeof(HFResultCache) + HF_CACHE_SHARDS*sizeof(shard_t);
+	for (int i=0;i < HF_CACHE_SHARDS;i++){
+		lock_guard<mutex> lock(m_shards[i].mutex);
+		n += m_shards[i].slots.capacity()*sizeof(slot_t);
+		n += m_shards[i].index.size()*(sizeof(key_t) + sizeof(size_t) + 2*sizeof(void*));
+		for (const slot_t &slot : m_shards[i].slots){
+			n += slot.results.capacity()*sizeof(hf_t);
+		}
+	}
+	return n;
+}
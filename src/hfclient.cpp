@@ -0,0 +1,200 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "hft/hfclient.hpp"
+
+using namespace std;
+using namespace hft;
+
+#define READ_SIZE 65536
+
+static void throw_errno(const string &what){
+	throw runtime_error(what + ": " + strerror(errno));
+}
+
+hft::HFClient::HFClient():m_fd(-1),m_next_id(1),m_in_pos(0){}
+
+hft::HFClient::~HFClient(){
+	Close();
+}
+
+void hft::HFClient::ConnectUnix(const string &path){
+	Close();
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) throw runtime_error("socket path too long");
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) throw_errno("socket");
+	if (connect(m_fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+		Close();
+		throw_errno("connect " + path);
+	}
+}
+
+void hft::HFClient::ConnectTCP(const int port, const string &host){
+	Close();
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) throw runtime_error("bad address " + host);
+
+	m_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) throw_errno("socket");
+	int one = 1;
+	setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(m_fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+		Close();
+		throw_errno("connect");
+	}
+}
+
+void hft::HFClient::Close(){
+	if (m_fd >= 0) close(m_fd);
+	m_fd = -1;
+	m_out.clear();
+	m_in.clear();
+	m_in_pos = 0;
+}
+
+uint32_t hft::HFClient::Send(const hf_request_t &req){
+	hf_request_t msg = req;
+	msg.req_id = m_next_id++;
+	EncodeRequest(msg, m_out);
+	return msg.req_id;
+}
+
+void hft::HFClient::Flush(){
+	size_t pos = 0;
+	while (pos < m_out.size()){
+		ssize_t n = send(m_fd, m_out.data() + pos, m_out.size() - pos, MSG_NOSIGNAL);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			throw_errno("send");
+		}
+		pos += n;
+	}
+	m_out.clear();
+}
+
+bool hft::HFClient::DecodeBuffered(hf_response_t &resp){
+	size_t n = DecodeResponse(m_in.data() + m_in_pos, m_in.size() - m_in_pos, resp);
+	if (n > 0){
+		m_in_pos += n;
+		if (m_in_pos == m_in.size()){
+			m_in.clear();
+			m_in_pos = 0;
+		}
+		return true;
+	}
+
+	if (m_in_pos > 0){
+		m_in.erase(0, m_in_pos);
+		m_in_pos = 0;
+	}
+	return false;
+}
+
+void hft::HFClient::Receive(hf_response_t &resp){
+	Receive(resp, -1);
+}
+
+bool hft::HFClient::Receive(hf_response_t &resp, const int timeout_ms){
+	const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+	char buf[READ_SIZE];
+	while (true){
+		if (DecodeBuffered(resp)) return true;
+
+		int wait = -1;
+		if (timeout_ms >= 0){
+			auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+			wait = (left.count() > 0) ? (int)left.count() : 0;
+		}
+		pollfd pfd = { m_fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, wait);
+		if (ready < 0){
+			if (errno == EINTR) continue;
+			throw_errno("poll");
+		}
+		if (ready == 0) return false;
+
+		ssize_t r = recv(m_fd, buf, sizeof(buf), 0);
+		if (r == 0) throw runtime_error("connection closed");
+		if (r < 0){
+			if (errno == EINTR) continue;
+			throw_errno("recv");
+		}
+		m_in.append(buf, r);
+	}
+}
+
+int hft::HFClient::Fd()const{
+	return m_fd;
+}
+
+hf_response_t hft::HFClient::Call(const hf_request_t &req){
+	uint32_t req_id = Send(req);
+	Flush();
+	// skip responses to earlier requests given up on after a timeout
+	hf_response_t resp;
+	do {
+		Receive(resp);
+	} while (resp.req_id != req_id);
+	if (resp.status == HF_STATUS_TOOMANY) throw runtime_error("too many results");
+	if (resp.status != HF_STATUS_OK) throw runtime_error("request failed");
+	return resp;
+}
+
+void hft::HFClient::Insert(const hf_t &item){
+	Call({ HF_MSG_INSERT, item.id, item.code, 0 });
+}
+
+void hft::HFClient::Delete(const hf_t &item){
+	Call({ HF_MSG_DELETE, item.id, item.code, 0 });
+}
+
+vector<hf_t> hft::HFClient::RangeSearch(const uint64_t target, const int radius){
+	return Call({ HF_MSG_RANGE, 0, target, radius }).results;
+}
+
+vector<hf_t> hft::HFClient::RangeSearchFast(const uint64_t target, const int radius){
+	return Call({ HF_MSG_RANGEFAST, 0, target, radius }).results;
+}
+
+vector<hf_t> hft::HFClient::KNearestSearch(const uint64_t target, const int k){
+	return Call({ HF_MSG_KNN, 0, target, k }).results;
+}
+
+size_t hft::HFClient::Count(const uint64_t target, const int radius){
+	return Call({ HF_MSG_COUNT, 0, target, radius }).count;
+}
@@ -0,0 +1,168 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include "hft/hfcodetable.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::HFCodeTable::HFCodeTable(){
+	m_count = 0;
+	m_shift = NDIMS;
+}
+
+size_t hft::HFCodeTable::Home(const uint64_t code)const{
+	// codes may be correlated in their low bits, so take the high bits of a multiplicative hash
+	return (size_t)((code*0x9e3779b97f4a7c15ULL) >> m_shift);
+}
+
+void hft::HFCodeTable::Place(const hf_t &item){
+	const size_t mask = m_slots.size() - 1;
+	size_t i = Home(item.code);
+	while (m_slots[i].code != HF_TABLE_EMPTY){
+		i = (i + 1) & mask;
+	}
+	m_slots[i] = item;
+}
+
+void hft::HFCodeTable::Rehash(const size_t n_slots){
+	vector<hf_t> old(n_slots, hf_t(0, HF_TABLE_EMPTY));
+	old.swap(m_slots);
+	m_shift = NDIMS - __builtin_ctzll(n_slots);
+	for (const hf_t &e : old){
+		if (e.code != HF_TABLE_EMPTY) Place(e);
+	}
+}
+
+void hft::HFCodeTable::Reserve(const size_t n){
+	size_t n_slots = HF_TABLE_MIN_SLOTS;
+	while (n_slots < 2*n) n_slots *= 2;
+	if (n_slots > m_slots.size()) Rehash(n_slots);
+}
+
+void hft::HFCodeTable::Insert(const hf_t &item){
+	if (item.code == HF_TABLE_EMPTY){
+		m_empty_ids.push_back(item.id);
+		return;
+	}
+	Reserve(m_count + 1);
+	Place(item);
+	m_count++;
+}
+
+void hft::HFCodeTable::Delete(const hf_t &item){
+	if (item.code == HF_TABLE_EMPTY){
+		for (size_t i=0;i < m_empty_ids.size();){
+			if (m_empty_ids[i] == item.id){
+				m_empty_ids[i] = m_empty_ids.back();
+				m_empty_ids.pop_back();
+			} else {
+				i++;
+			}
+		}
+		return;
+	}
+	if (m_count == 0) return;
+
+	const size_t mask = m_slots.size() - 1;
+	size_t i = Home(item.code);
+	while (m_slots[i].code != HF_TABLE_EMPTY){
+		if (m_slots[i].code != item.code || m_slots[i].id != item.id){
+			i = (i + 1) & mask;
+			continue;
+		}
+
+		// backward shift: move up any later entry of the run that may live at i
+		size_t hole = i, j = i;
+		while (true){
+			j = (j + 1) & mask;
+			if (m_slots[j].code == HF_TABLE_EMPTY) break;
+			size_t home = Home(m_slots[j].code);
+			bool movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+			if (movable){
+				m_slots[hole] = m_slots[j];
+				hole = j;
+			}
+		}
+		m_slots[hole] = hf_t(0, HF_TABLE_EMPTY);
+		m_count--;
+		// slot i now holds the next entry of the run, if any
+	}
+}
+
+bool hft::HFCodeTable::Contains(const uint64_t code)const{
+	if (code == HF_TABLE_EMPTY) return !m_empty_ids.empty();
+	if (m_count == 0) return false;
+
+	const size_t mask = m_slots.size() - 1;
+	for (size_t i=Home(code);m_slots[i].code != HF_TABLE_EMPTY;i=(i+1)&mask){
+		if (m_slots[i].code == code) return true;
+	}
+	return false;
+}
+
+void hft::HFCodeTable::Lookup(const uint64_t code, vector<hf_t> &results)const{
+	if (code == HF_TABLE_EMPTY){
+		for (hf_id_t id : m_empty_ids){
+			results.push_back(hf_t(id, code));
+		}
+		return;
+	}
+	if (m_count == 0) return;
+
+	const size_t mask = m_slots.size() - 1;
+	for (size_t i=Home(code);m_slots[i].code != HF_TABLE_EMPTY;i=(i+1)&mask){
+		if (m_slots[i].code == code) results.push_back(m_slots[i]);
+	}
+}
+
+vector<bool> hft::HFCodeTable::Contains(const vector<uint64_t> &codes)const{
+	vector<bool> found(codes.size());
+	for (size_t i=0;i < codes.size();i++){
+		if (i + HF_TABLE_PREFETCH < codes.size() && m_count > 0)
+			__builtin_prefetch(&m_slots[Home(codes[i + HF_TABLE_PREFETCH])]);
+		found[i] = Contains(codes[i]);
+	}
+	return found;
+}
+
+vector<vector<hf_t>> hft::HFCodeTable::Lookup(const vector<uint64_t> &codes)const{
+	vector<vector<hf_t>> results(codes.size());
+	for (size_t i=0;i < codes.size();i++){
+		if (i + HF_TABLE_PREFETCH < codes.size() && m_count > 0)
+			__builtin_prefetch(&m_slots[Home(codes[i + HF_TABLE_PREFETCH])]);
+		Lookup(codes[i], results[i]);
+	}
+	return results;
+}
+
+size_t hft::HFCodeTable::Size()const{
+	return m_count + m_empty_ids.size();
+}
+
+void hft::HFCodeTable::Clear(){
+	vector<hf_t>().swap(m_slots);
+	vector<hf_id_t>().swap(m_empty_ids);
+	m_count = 0;
+	m_shift = NDIMS;
+}
+
+size_t hft::HFCodeTable::MemoryUsage()const{
+	return m_slots.capacity()*sizeof(hf_t) + m_empty_ids.capacity()*sizeof(hf_id_t);
+}
@@ -0,0 +1,255 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <sstream>
+#include "hft/hfmetrics.hpp"
+
+using namespace std;
+using namespace hft;
+
+#define HF_HIST_SUBS (1 << HF_HIST_SUBBITS)
+#define HF_HIST_LINEAR (2*HF_HIST_SUBS)
+
+static const char *op_names[HF_OP_COUNT] = { "insert", "delete", "range_search", "range_search_fast",
+												 "range_search_parallel", "range_search_flat",
+												 "range_search_masked" };
+
+static const char *counter_names[HF_CTR_COUNT] = { "leaf_splits", "flat_scans", "cache_hits", "cache_misses",
+													"root_slots_written" };
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/**
+ *  HFHistogram Impl.
+ *
+ **/
+hft::HFHistogram::HFHistogram(){
+	Reset();
+}
+
+int hft::HFHistogram::BucketOf(const uint64_t value){
+	if (value < HF_HIST_LINEAR) return (int)value;
+	int e = 63 - __builtin_clzll(value);
+	int sub = (int)((value >> (e - HF_HIST_SUBBITS)) & (HF_HIST_SUBS - 1));
+	return HF_HIST_LINEAR + (e - HF_HIST_SUBBITS - 1)*HF_HIST_SUBS + sub;
+}
+
+uint64_t hft::HFHistogram::BucketUpperBound(const int bucket){
+	if (bucket < HF_HIST_LINEAR) return bucket;
+	int e = (bucket - HF_HIST_LINEAR)/HF_HIST_SUBS + HF_HIST_SUBBITS + 1;
+	uint64_t sub = (bucket - HF_HIST_LINEAR) % HF_HIST_SUBS;
+	uint64_t lower = (HF_HIST_SUBS + sub) << (e - HF_HIST_SUBBITS);
+	return lower + ((1ULL << (e - HF_HIST_SUBBITS)) - 1);
+}
+
+void hft::HFHistogram::Record(const uint64_t value){
+	m_counts[BucketOf(value)].fetch_add(1, memory_order_relaxed);
+	m_sum.fetch_add(value, memory_order_relaxed);
+	uint64_t prev = m_max.load(memory_order_relaxed);
+	while (value > prev && !m_max.compare_exchange_weak(prev, value, memory_order_relaxed));
+}
+
+void hft::HFHistogram::Reset(){
+	for (int i=0;i < HF_HIST_BUCKETS;i++){
+		m_counts[i].store(0, memory_order_relaxed);
+	}
+	m_sum.store(0, memory_order_relaxed);
+	m_max.store(0, memory_order_relaxed);
+}
+
+hft::hf_histogram_snapshot_t::hf_histogram_snapshot_t():counts(HF_HIST_BUCKETS, 0),count(0),sum(0),max(0){}
+
+void hft::hf_histogram_snapshot_t::Merge(const HFHistogram &hist){
+	for (int i=0;i < HF_HIST_BUCKETS;i++){
+		uint64_t n = hist.m_counts[i].load(memory_order_relaxed);
+		counts[i] += n;
+		count += n;
+	}
+	sum += hist.m_sum.load(memory_order_relaxed);
+	uint64_t m = hist.m_max.load(memory_order_relaxed);
+	if (m > max) max = m;
+}
+
+double hft::hf_histogram_snapshot_t::Mean()const{
+	return (count > 0) ? (double)sum/(double)count : 0.0;
+}
+
+uint64_t hft::hf_histogram_snapshot_t::Percentile(const double q)const{
+	if (count == 0) return 0;
+	uint64_t rank = (uint64_t)(q*(double)count);
+	if (rank >= count) rank = count - 1;
+	uint64_t seen = 0;
+	for (int i=0;i < HF_HIST_BUCKETS;i++){
+		seen += counts[i];
+		if (seen > rank){
+			uint64_t upper = HFHistogram::BucketUpperBound(i);
+			return (upper < max) ? upper : max;
+		}
+	}
+	return max;
+}
+
+static void write_summary_prom(ostream &ostrm, const string &name, const string &labels,
+							   const hf_histogram_snapshot_t &hist, const double scale){
+	string sep = labels.empty() ? "" : ",";
+	for (double q : quantiles){
+		ostrm << name << "{" << labels << sep << "quantile=\"" << q << "\"} "
+			  << (double)hist.Percentile(q)*scale << "\n";
+	}
+	string braces = labels.empty() ? "" : "{" + labels + "}";
+	ostrm << name << "_sum" << braces << " " << (double)hist.sum*scale << "\n";
+	ostrm << name << "_count" << braces << " " << hist.count << "\n";
+}
+
+static void write_summary_json(ostream &ostrm, const hf_histogram_snapshot_t &hist){
+	ostrm << "{\"count\":" << hist.count << ",\"sum\":" << hist.sum
+		  << ",\"mean\":" << hist.Mean() << ",\"max\":" << hist.max
+		  << ",\"p50\":" << hist.Percentile(0.5) << ",\"p90\":" << hist.Percentile(0.9)
+		  << ",\"p99\":" << hist.Percentile(0.99) << ",\"p999\":" << hist.Percentile(0.999) << "}";
+}
+
+string hft::hf_metrics_snapshot_t::ToPrometheus()const{
+	ostringstream ss;
+
+	ss << "# TYPE hftrie_op_latency_seconds summary\n";
+	for (int op=0;op < HF_OP_COUNT;op++){
+		write_summary_prom(ss, "hftrie_op_latency_seconds", string("op=\"") + op_names[op] + "\"",
+						   latency[op], 1.0e-9);
+	}
+
+	ss << "# TYPE hftrie_result_size summary\n";
+	write_summary_prom(ss, "hftrie_result_size", "", result_sizes, 1.0);
+
+	for (int c=0;c < HF_CTR_COUNT;c++){
+		ss << "# TYPE hftrie_" << counter_names[c] << "_total counter\n";
+		ss << "hftrie_" << counter_names[c] << "_total " << counters[c] << "\n";
+	}
+
+	ss << "# TYPE hftrie_nodes gauge\n";
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		if (internal_nodes[l] != 0)
+			ss << "hftrie_nodes{kind=\"internal\",level=\"" << l << "\"} " << internal_nodes[l] << "\n";
+		if (leaf_nodes[l] != 0)
+			ss << "hftrie_nodes{kind=\"leaf\",level=\"" << l << "\"} " << leaf_nodes[l] << "\n";
+	}
+	return ss.str();
+}
+
+string hft::hf_metrics_snapshot_t::ToJSON()const{
+	ostringstream ss;
+
+	ss << "{\"latency_ns\":{";
+	for (int op=0;op < HF_OP_COUNT;op++){
+		ss << (op > 0 ? "," : "") << "\"" << op_names[op] << "\":";
+		write_summary_json(ss, latency[op]);
+	}
+	ss << "},\"result_size\":";
+	write_summary_json(ss, result_sizes);
+
+	ss << ",\"counters\":{";
+	for (int c=0;c < HF_CTR_COUNT;c++){
+		ss << (c > 0 ? "," : "") << "\"" << counter_names[c] << "\":" << counters[c];
+	}
+
+	ss << "},\"nodes\":{\"internal\":[";
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		ss << (l > 0 ? "," : "") << internal_nodes[l];
+	}
+	ss << "],\"leaf\":[";
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		ss << (l > 0 ? "," : "") << leaf_nodes[l];
+	}
+	ss << "]}}";
+	return ss.str();
+}
+
+/**
+ *  HFMetrics Impl.
+ *
+ **/
+static atomic<unsigned int> next_shard(0);
+
+hft::HFMetrics::HFMetrics(){
+	m_shards = new shard_t[HF_METRIC_SHARDS];
+	Reset();
+	ResetNodes();
+}
+
+hft::HFMetrics::~HFMetrics(){
+	delete[] m_shards;
+}
+
+HFMetrics::shard_t& hft::HFMetrics::LocalShard(){
+	static thread_local unsigned int shard = next_shard.fetch_add(1, memory_order_relaxed) % HF_METRIC_SHARDS;
+	return m_shards[shard];
+}
+
+void hft::HFMetrics::RecordLatency(const hf_op_t op, const uint64_t nsecs){
+	LocalShard().latency[op].Record(nsecs);
+}
+
+void hft::HFMetrics::RecordResults(const size_t n){
+	LocalShard().result_sizes.Record(n);
+}
+
+void hft::HFMetrics::Increment(const hf_counter_t ctr, const uint64_t n){
+	m_counters[ctr].fetch_add(n, memory_order_relaxed);
+}
+
+void hft::HFMetrics::AddNodes(const int level, const long long n_internal, const long long n_leaves){
+	m_internal[level].fetch_add(n_internal, memory_order_relaxed);
+	m_leaves[level].fetch_add(n_leaves, memory_order_relaxed);
+}
+
+void hft::HFMetrics::ResetNodes(){
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		m_internal[l].store(0, memory_order_relaxed);
+		m_leaves[l].store(0, memory_order_relaxed);
+	}
+}
+
+void hft::HFMetrics::Reset(){
+	for (int i=0;i < HF_METRIC_SHARDS;i++){
+		for (int op=0;op < HF_OP_COUNT;op++){
+			m_shards[i].latency[op].Reset();
+		}
+		m_shards[i].result_sizes.Reset();
+	}
+	for (int c=0;c < HF_CTR_COUNT;c++){
+		m_counters[c].store(0, memory_order_relaxed);
+	}
+}
+
+hf_metrics_snapshot_t hft::HFMetrics::Snapshot()const{
+	hf_metrics_snapshot_t snapshot;
+	for (int i=0;i < HF_METRIC_SHARDS;i++){
+		for (int op=0;op < HF_OP_COUNT;op++){
+			snapshot.latency[op].Merge(m_shards[i].latency[op]);
+		}
+		snapshot.result_sizes.Merge(m_shards[i].result_sizes);
+	}
+	for (int c=0;c < HF_CTR_COUNT;c++){
+		snapshot.counters[c] = m_counters[c].load(memory_order_relaxed);
+	}
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		snapshot.internal_nodes[l] = m_internal[l].load(memory_order_relaxed);
+		snapshot.leaf_nodes[l] = m_leaves[l].load(memory_order_relaxed);
+	}
+	return snapshot;
+}
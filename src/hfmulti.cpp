@@ -0,0 +1,190 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <stdexcept>
+#include "hft/hfmulti.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::HFMultiIndex::HFMultiIndex(const int n_substrings){
+	if (n_substrings < 1 || n_substrings > HF_MAX_SUBSTRINGS)
+		throw invalid_argument("bad number of substrings");
+
+	m_nsubs = n_substrings;
+	int start = 0;
+	for (int s=0;s < m_nsubs;s++){
+		m_start[s] = start;
+		m_len[s] = NDIMS/m_nsubs + ((s < NDIMS % m_nsubs) ? 1 : 0);
+		start += m_len[s];
+	}
+
+	m_direct.resize(m_nsubs);
+	m_hashed.resize(m_nsubs);
+	m_count = 0;
+	Clear();
+}
+
+uint64_t hft::HFMultiIndex::SubstringMask(const int s)const{
+	uint64_t mask = (m_len[s] == NDIMS) ? ~0ULL : ((0x01ULL << m_len[s]) - 1);
+	return mask << (NDIMS - m_start[s] - m_len[s]);
+}
+
+uint64_t hft::HFMultiIndex::Substring(const uint64_t code, const int s)const{
+	return (code & SubstringMask(s)) >> (NDIMS - m_start[s] - m_len[s]);
+}
+
+HFMultiIndex::bucket_t* hft::HFMultiIndex::GetBucket(const int s, const uint64_t key, const bool create){
+	if (m_len[s] <= HF_DIRECT_BITS) return &m_direct[s][key];
+
+	auto iter = m_hashed[s].find(key);
+	if (iter != m_hashed[s].end()) return &iter->second;
+	return create ? &m_hashed[s][key] : NULL;
+}
+
+const HFMultiIndex::bucket_t* hft::HFMultiIndex::FindBucket(const int s, const uint64_t key)const{
+	if (m_len[s] <= HF_DIRECT_BITS) return &m_direct[s][key];
+
+	auto iter = m_hashed[s].find(key);
+	return (iter != m_hashed[s].end()) ? &iter->second : NULL;
+}
+
+void hft::HFMultiIndex::Insert(const hf_t &item){
+	uint32_t slot;
+	if (!m_free.empty()){
+		slot = m_free.back();
+		m_free.pop_back();
+		m_entries[slot] = item;
+	} else {
+		slot = m_entries.size();
+		m_entries.push_back(item);
+	}
+
+	for (int s=0;s < m_nsubs;s++){
+		GetBucket(s, Substring(item.code, s), true)->push_back(slot);
+	}
+	m_count++;
+}
+
+void hft::HFMultiIndex::Delete(const hf_t &item){
+	bucket_t *first = GetBucket(0, Substring(item.code, 0), false);
+	if (first == NULL) return;
+
+	vector<uint32_t> slots;
+	for (uint32_t slot : *first){
+		if (m_entries[slot].id == item.id && m_entries[slot].code == item.code) slots.push_back(slot);
+	}
+
+	for (uint32_t slot : slots){
+		for (int s=0;s < m_nsubs;s++){
+			uint64_t key = Substring(item.code, s);
+			bucket_t *bucket = GetBucket(s, key, false);
+			for (size_t i=0;i < bucket->size();i++){
+				if ((*bucket)[i] == slot){
+					(*bucket)[i] = bucket->back();
+					bucket->pop_back();
+					break;
+				}
+			}
+			if (bucket->empty() && m_len[s] > HF_DIRECT_BITS) m_hashed[s].erase(key);
+		}
+		m_free.push_back(slot);
+		m_count--;
+	}
+}
+
+void hft::HFMultiIndex::SearchTable(const int s, const uint64_t target, const int sub_radius,
+									const int radius, vector<hf_t> &results)const{
+	const int len = m_len[s];
+	const uint64_t key = Substring(target, s);
+	const int max_flips = min(sub_radius, len);
+
+	// enumerate every key within max_flips bits of key, as combinations of bit positions
+	int pos[NDIMS];
+	for (int k=0;k <= max_flips;k++){
+		for (int i=0;i < k;i++) pos[i] = i;
+		while (true){
+			uint64_t probe = key;
+			for (int i=0;i < k;i++) probe ^= (0x01ULL << pos[i]);
+
+			const bucket_t *bucket = FindBucket(s, probe);
+			if (bucket != NULL){
+				for (uint32_t slot : *bucket){
+					const hf_t &e = m_entries[slot];
+					if (e.hdistance(target) > radius) continue;
+
+					bool seen = false;
+					for (int t=0;t < s && !seen;t++){
+						seen = __builtin_popcountll((e.code^target) & SubstringMask(t)) <= sub_radius;
+					}
+					if (!seen) results.push_back(e);
+				}
+			}
+
+			// next combination
+			int i = k - 1;
+			while (i >= 0 && pos[i] == len - k + i) i--;
+			if (i < 0) break;
+			pos[i]++;
+			for (int j=i+1;j < k;j++) pos[j] = pos[j-1] + 1;
+		}
+	}
+}
+
+vector<hf_t> hft::HFMultiIndex::RangeSearch(const uint64_t target, const int radius)const{
+	vector<hf_t> results;
+	if (radius < 0 || m_count == 0) return results;
+
+	const int sub_radius = radius/m_nsubs;
+	for (int s=0;s < m_nsubs;s++){
+		SearchTable(s, target, sub_radius, radius, results);
+	}
+	return results;
+}
+
+size_t hft::HFMultiIndex::Size()const{
+	return m_count;
+}
+
+void hft::HFMultiIndex::Clear(){
+	m_entries.clear();
+	m_free.clear();
+	m_count = 0;
+	for (int s=0;s < m_nsubs;s++){
+		m_direct[s].clear();
+		m_hashed[s].clear();
+		if (m_len[s] <= HF_DIRECT_BITS) m_direct[s].resize(0x01ULL << m_len[s]);
+	}
+}
+
+size_t hft::HFMultiIndex::MemoryUsage()const{
+	size_t nbytes = sizeof(HFMultiIndex);
+	nbytes += m_entries.capacity()*sizeof(hf_t) + m_free.capacity()*sizeof(uint32_t);
+	for (int s=0;s < m_nsubs;s++){
+		nbytes += m_direct[s].capacity()*sizeof(bucket_t);
+		for (const bucket_t &b : m_direct[s]){
+			nbytes += b.capacity()*sizeof(uint32_t);
+		}
+		for (auto &kv : m_hashed[s]){
+			nbytes += sizeof(kv) + 2*sizeof(void*) + kv.second.capacity()*sizeof(uint32_t);
+		}
+		nbytes += m_hashed[s].bucket_count()*sizeof(void*);
+	}
+	return nbytes;
+}
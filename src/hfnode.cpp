@@ -17,10 +17,35 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 **/
 
+#include <algorithm>
 #include "hft/hfnode.hpp"
+#include "hft/hfstore.hpp"
 
 using namespace hft;
 
+static constexpr int count_bits(unsigned int x){
+	int n = 0;
+	for (;x != 0;x &= x-1) n++;
+	return n;
+}
+
+static constexpr hf_neighbors_t build_neighbors(){
+	hf_neighbors_t tbl = {};
+	for (int idx=0;idx < NODE_FANOUT;idx++){
+		int pos = 0;
+		for (int d=0;d <= CHUNKSIZE;d++){
+			tbl.offsets[idx][d] = pos;
+			for (int i=0;i < NODE_FANOUT;i++){
+				if (count_bits(idx^i) == d) tbl.children[idx][pos++] = i;
+			}
+		}
+		tbl.offsets[idx][CHUNKSIZE+1] = pos;
+	}
+	return tbl;
+}
+
+constexpr hf_neighbors_t hft::hf_neighbors = build_neighbors();
+
 /**
  *  HFInternal Impl.
  *
@@ -28,6 +53,7 @@ using namespace hft;
 hft::HFNode::~HFNode(){}
 
 hft::HFInternal::HFInternal(){
+	m_occupied = 0;
 	for (int i=0;i < NODE_FANOUT;i++){
 		m_nodes[i] = NULL;
 	}
@@ -49,15 +75,21 @@ size_t hft::HFInternal::nbytes()const{
 
 void hft::HFInternal::SetChildNode(HFNode *node, const int idx){
 	m_nodes[idx] = node;
+	if (node != NULL){
+		m_occupied |= (0x01U << idx);
+	} else {
+		m_occupied &= ~(0x01U << idx);
+	}
 }
 
 bool hft::HFInternal::HasChildNode(const uint64_t idx)const{
 	return (m_nodes[idx] != NULL);
 }
 
-HFNode* hft::HFInternal::GetChildNode(const uint64_t idx){
+HFNode* hft::HFInternal::GetChildNode(const uint64_t idx, const bool packed, HFLeafStore *store){
 	if (m_nodes[idx] == NULL){
-		m_nodes[idx] = new HFLeaf();
+		m_nodes[idx] = HFLeaf::Create(packed, store);
+		m_occupied |= (0x01U << idx);
 	}
 	return m_nodes[idx];
 }
@@ -70,6 +102,10 @@ void hft::HFInternal::GetChildNodes(std::queue<HFNode*> &nodes)const{
 	}
 }
 
+int hft::HFInternal::NumChildNodes()const{
+	return __builtin_popcount(m_occupied);
+}
+
 void hft::HFInternal::SearchFast(const uint64_t target, uint64_t target_idx, const int level, const int radius,
 							 std::queue<hf_search_t> &nodes){
 
@@ -78,13 +114,11 @@ void hft::HFInternal::SearchFast(const uint64_t target, uint64_t target_idx, con
 	}
 	
 	if (radius > 0){
-		uint64_t mask = 0x0001ULL << (CHUNKSIZE-1);
-		while (mask != 0){
-			uint64_t idx = target_idx^mask;
-			if (m_nodes[idx] != NULL){
-				nodes.push({ m_nodes[idx], level+1, radius - 1 });
+		const uint8_t *children = hf_neighbors.children[target_idx].data();
+		for (int j=hf_neighbors.offsets[target_idx][1];j < hf_neighbors.offsets[target_idx][2];j++){
+			if (m_occupied & (0x01U << children[j])){
+				nodes.push({ m_nodes[children[j]], level+1, radius - 1 });
 			}
-			mask >>= 1;
 		}
 	}
 }
@@ -92,11 +126,21 @@ void hft::HFInternal::SearchFast(const uint64_t target, uint64_t target_idx, con
 void hft::HFInternal::Search(const uint64_t target, uint64_t target_idx, const int level, const int radius,
 							 std::queue<hf_search_t> &nodes){
 
-	for (uint64_t i=0;i < NODE_FANOUT;i++){
-		if (m_nodes[i] != NULL){
-			int d = radius - __builtin_popcountll(target_idx^i);
-			if (d >= 0){
-				nodes.push({ m_nodes[i], level+1, d});
+	if (radius >= CHUNKSIZE){
+		for (uint32_t bits = m_occupied;bits != 0;bits &= bits-1){
+			int i = __builtin_ctz(bits);
+			nodes.push({ m_nodes[i], level+1, radius - __builtin_popcountll(target_idx^i) });
+		}
+		return;
+	}
+
+	// only visit the children that are within the remaining radius
+	const uint8_t *children = hf_neighbors.children[target_idx].data();
+	const uint8_t *offsets = hf_neighbors.offsets[target_idx].data();
+	for (int d=0;d <= radius;d++){
+		for (int j=offsets[d];j < offsets[d+1];j++){
+			if (m_occupied & (0x01U << children[j])){
+				nodes.push({ m_nodes[children[j]], level+1, radius - d });
 			}
 		}
 	}
@@ -106,40 +150,53 @@ void hft::HFInternal::Search(const uint64_t target, uint64_t target_idx, const i
  *  HFLeaf Impl
  *
  **/
-hft::HFLeaf::HFLeaf(){}
-
-hft::HFLeaf::~HFLeaf(){}
-
 bool hft::HFLeaf::IsLeaf()const{
 	return true;
 }
 
-size_t hft::HFLeaf::Size()const{
+HFLeaf* hft::HFLeaf::Create(const bool packed, HFLeafStore *store){
+	if (store != NULL) return new HFStoredLeaf(store);
+	if (packed) return new HFPackedLeaf();
+	return new HFListLeaf();
+}
+
+/**
+ *  HFListLeaf Impl
+ *
+ **/
+hft::HFListLeaf::HFListLeaf(){}
+
+hft::HFListLeaf::~HFListLeaf(){}
+
+size_t hft::HFListLeaf::Size()const{
 	return m_entries.size();
 }
 
-size_t hft::HFLeaf::nbytes()const{
-	return sizeof(HFLeaf) + m_entries.capacity()*sizeof(hf_t);
+size_t hft::HFListLeaf::nbytes()const{
+	return sizeof(HFListLeaf) + m_entries.capacity()*sizeof(hf_t);
 }
 
-void hft::HFLeaf::Add(const hf_t &item, const int level){
+void hft::HFListLeaf::Add(const hf_t &item, const int level){
 	m_entries.push_back(item);
 }
 
-const std::vector<hf_t>& hft::HFLeaf::GetEntries()const{
-	return m_entries;
+void hft::HFListLeaf::GetEntries(std::vector<hf_t> &entries, const int level)const{
+	entries.insert(entries.end(), m_entries.begin(), m_entries.end());
 }
 
-void hft::HFLeaf::Search(const uint64_t target, const uint64_t target_idx, const int level,
-						 const int radius, std::vector<hf_t> &results){
+void hft::HFListLeaf::Search(const uint64_t target, const uint64_t target_idx, const int level,
+							 const int radius, std::vector<hf_t> &results, std::vector<int> *distances){
 	for (hf_t &e : m_entries){
-		if (e.hdistance(target) <= radius){
+		int d = __builtin_popcountll(e.code^target);
+		if (d <= radius){
 			results.push_back(e);
+			if (distances != NULL) distances->push_back(d);
 		}
 	}
+	hf_t::n_ops.fetch_add(m_entries.size(), std::memory_order_relaxed);
 }
 
-void hft::HFLeaf::Delete(const hf_t &item, const int level){
+void hft::HFListLeaf::Delete(const hf_t &item, const int level){
 	for (auto iter=m_entries.begin();iter != m_entries.end();){
 		if (iter->id == item.id && iter->code == item.code){
 			iter = m_entries.erase(iter);
@@ -147,5 +204,250 @@ void hft::HFLeaf::Delete(const hf_t &item, const int level){
 			iter++;
 		}
 	}
+	if (m_entries.size() <= m_entries.capacity()/4) m_entries.shrink_to_fit();
+}
+
+void hft::HFListLeaf::Shrink(){
+	m_entries.shrink_to_fit();
+}
+
+/**
+ *  HFPackedLeaf Impl
+ *
+ **/
+static inline int suffix_bytes(const int level){
+	return (NDIMS - level*CHUNKSIZE + 7)/8;
+}
+
+static inline uint64_t prefix_mask(const int level){
+	return (level == 0) ? 0 : ~0ULL << (NDIMS - level*CHUNKSIZE);
+}
+
+static inline uint64_t load_suffix(const uint8_t *p, const int n){
+	uint64_t v = 0;
+	for (int i=0;i < n;i++){
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static inline int varint_size(uint64_t v){
+	int n = 1;
+	for (;v >= 0x80;v >>= 7) n++;
+	return n;
+}
+
+static inline uint8_t* put_varint(uint8_t *p, uint64_t v){
+	for (;v >= 0x80;v >>= 7){
+		*p++ = (uint8_t)(v | 0x80);
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static inline const uint8_t* get_varint(const uint8_t *p, uint64_t &v){
+	v = 0;
+	for (int shift=0;;shift += 7){
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) break;
+	}
+	return p;
+}
+
+/* the first id is zigzag encoded, the rest are deltas from the previous id */
+static inline uint64_t id_delta(const hf_id_t prev, const hf_id_t id, const bool first){
+	if (first) return ((uint64_t)id << 1) ^ (uint64_t)((int64_t)id >> 63);
+	return (uint64_t)id - (uint64_t)prev;
+}
+
+static inline hf_id_t id_undelta(const hf_id_t prev, const uint64_t v, const bool first){
+	if (first) return (hf_id_t)((v >> 1) ^ (~(v & 1) + 1));
+	return (hf_id_t)((uint64_t)prev + v);
+}
+
+hft::HFPackedLeaf::HFPackedLeaf(){
+	m_prefix = 0;
+	m_data = NULL;
+	m_count = 0;
+	m_nbytes = 0;
+}
+
+hft::HFPackedLeaf::~HFPackedLeaf(){
+	if (m_nbytes > HF_PACKED_INLINE) delete[] m_data;
+}
+
+const uint8_t* hft::HFPackedLeaf::Data()const{
+	return (m_nbytes > HF_PACKED_INLINE) ? m_data : m_inline;
 }
 
+size_t hft::HFPackedLeaf::Size()const{
+	return m_count;
+}
+
+size_t hft::HFPackedLeaf::nbytes()const{
+	return sizeof(HFPackedLeaf) + ((m_nbytes > HF_PACKED_INLINE) ? m_nbytes : 0);
+}
+
+void hft::HFPackedLeaf::Encode(std::vector<hf_t> &entries, const int level){
+	std::sort(entries.begin(), entries.end(), [](const hf_t &a, const hf_t &b){
+		return (a.id != b.id) ? a.id < b.id : a.code < b.code;
+	});
+
+	const int sb = suffix_bytes(level);
+	size_t n = sb*entries.size();
+	for (size_t i=0;i < entries.size();i++){
+		n += varint_size(id_delta((i > 0) ? entries[i-1].id : 0, entries[i].id, i == 0));
+	}
+
+	if (m_nbytes > HF_PACKED_INLINE) delete[] m_data;
+	if (n > HF_PACKED_INLINE) m_data = new uint8_t[n];
+	m_count = entries.size();
+	m_nbytes = n;
+	m_prefix = entries.empty() ? 0 : (entries[0].code & prefix_mask(level));
+
+	uint8_t *p = (uint8_t*)Data();
+	for (const hf_t &e : entries){
+		for (int i=sb-1;i >= 0;i--){
+			*p++ = (uint8_t)(e.code >> (8*i));
+		}
+	}
+	for (size_t i=0;i < entries.size();i++){
+		p = put_varint(p, id_delta((i > 0) ? entries[i-1].id : 0, entries[i].id, i == 0));
+	}
+}
+
+void hft::HFPackedLeaf::Add(const hf_t &item, const int level){
+	std::vector<hf_t> entries;
+	entries.reserve(m_count + 1);
+	GetEntries(entries, level);
+	entries.push_back(item);
+	Encode(entries, level);
+}
+
+void hft::HFPackedLeaf::GetEntries(std::vector<hf_t> &entries, const int level)const{
+	const int sb = suffix_bytes(level);
+	const uint8_t *data = Data();
+	const uint8_t *ids = data + (size_t)sb*m_count;
+	hf_id_t id = 0;
+	for (uint32_t i=0;i < m_count;i++){
+		uint64_t v;
+		ids = get_varint(ids, v);
+		id = id_undelta(id, v, i == 0);
+		entries.push_back({ id, m_prefix | load_suffix(data + (size_t)sb*i, sb) });
+	}
+}
+
+void hft::HFPackedLeaf::Search(const uint64_t target, const uint64_t target_idx, const int level,
+							   const int radius, std::vector<hf_t> &results, std::vector<int> *distances){
+	const int sb = suffix_bytes(level);
+
+	// ids are only decoded as far as the last match
+	const uint8_t *data = Data();
+	const uint8_t *ids = data + (size_t)sb*m_count;
+	uint32_t n_decoded = 0;
+	hf_id_t id = 0;
+	for (uint32_t i=0;i < m_count;i++){
+		uint64_t code = m_prefix | load_suffix(data + (size_t)sb*i, sb);
+		int d = __builtin_popcountll(code^target);
+		if (d > radius) continue;
+
+		for (;n_decoded <= i;n_decoded++){
+			uint64_t v;
+			ids = get_varint(ids, v);
+			id = id_undelta(id, v, n_decoded == 0);
+		}
+		results.push_back({ id, code });
+		if (distances != NULL) distances->push_back(d);
+	}
+	hf_t::n_ops.fetch_add(m_count, std::memory_order_relaxed);
+}
+
+void hft::HFPackedLeaf::Delete(const hf_t &item, const int level){
+	std::vector<hf_t> entries;
+	entries.reserve(m_count);
+	GetEntries(entries, level);
+
+	size_t n = entries.size();
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const hf_t &e){
+		return e.id == item.id && e.code == item.code;
+	}), entries.end());
+	if (entries.size() != n) Encode(entries, level);
+}
+
+void hft::HFPackedLeaf::Shrink(){}
+
+/**
+ *  HFStoredLeaf Impl
+ *
+ **/
+hft::HFStoredLeaf::HFStoredLeaf(HFLeafStore *store):m_store(store),m_offset(0),m_count(0),m_capacity(0){}
+
+hft::HFStoredLeaf::~HFStoredLeaf(){
+	if (m_capacity > 0) m_store->Release(m_offset, m_capacity);
+}
+
+size_t hft::HFStoredLeaf::Size()const{
+	return m_count;
+}
+
+size_t hft::HFStoredLeaf::nbytes()const{
+	return sizeof(HFStoredLeaf);
+}
+
+void hft::HFStoredLeaf::Encode(const std::vector<hf_t> &entries){
+	if (entries.size() > m_capacity){
+		if (m_capacity > 0) m_store->Release(m_offset, m_capacity);
+		m_capacity = HFLeafStore::Capacity(entries.size());
+		m_offset = m_store->Allocate(m_capacity);
+	}
+	m_count = entries.size();
+	if (m_count > 0) m_store->Write(m_offset, entries.data(), m_count);
+}
+
+void hft::HFStoredLeaf::Add(const hf_t &item, const int level){
+	std::vector<hf_t> entries;
+	GetEntries(entries, level);
+	entries.push_back(item);
+	Encode(entries);
+}
+
+void hft::HFStoredLeaf::GetEntries(std::vector<hf_t> &entries, const int level)const{
+	if (m_count > 0) m_store->Read(m_offset, m_count, entries);
+}
+
+void hft::HFStoredLeaf::Search(const uint64_t target, const uint64_t target_idx, const int level,
+							   const int radius, std::vector<hf_t> &results, std::vector<int> *distances){
+	static thread_local std::vector<hf_t> entries;
+	entries.clear();
+	GetEntries(entries, level);
+	for (hf_t &e : entries){
+		int d = __builtin_popcountll(e.code^target);
+		if (d <= radius){
+			results.push_back(e);
+			if (distances != NULL) distances->push_back(d);
+		}
+	}
+	hf_t::n_ops.fetch_add(entries.size(), std::memory_order_relaxed);
+}
+
+void hft::HFStoredLeaf::Delete(const hf_t &item, const int level){
+	std::vector<hf_t> entries;
+	GetEntries(entries, level);
+	auto last = std::remove_if(entries.begin(), entries.end(), [&item](const hf_t &e){
+		return e.id == item.id && e.code == item.code;
+	});
+	if (last == entries.end()) return;
+	entries.erase(last, entries.end());
+	Encode(entries);
+}
+
+void hft::HFStoredLeaf::Shrink(){
+	if (m_capacity == 0 || HFLeafStore::Capacity(m_count) == m_capacity) return;
+
+	std::vector<hf_t> entries;
+	GetEntries(entries, 0);
+	m_store->Release(m_offset, m_capacity);
+	m_capacity = 0;
+	Encode(entries);
+}
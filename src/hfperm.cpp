@@ -0,0 +1,194 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cmath>
+#include <stdexcept>
+#include "hft/hfperm.hpp"
+
+using namespace std;
+using namespace hft;
+
+#define N_BYTES (NDIMS/8)
+#define MAX_SAMPLE 65536
+
+static inline uint64_t bit_at(const int pos){
+	return 0x01ULL << (NDIMS - 1 - pos);
+}
+
+static double entropy(const double p){
+	if (p <= 0.0 || p >= 1.0) return 0.0;
+	return -p*log2(p) - (1.0-p)*log2(1.0-p);
+}
+
+hft::HFPermutation::HFPermutation(){
+	for (int i=0;i < NDIMS;i++){
+		m_order[i] = i;
+	}
+}
+
+hft::HFPermutation::HFPermutation(const int order[NDIMS]){
+	bool seen[NDIMS] = { false };
+	for (int i=0;i < NDIMS;i++){
+		if (order[i] < 0 || order[i] >= NDIMS || seen[order[i]])
+			throw invalid_argument("not a permutation");
+		seen[order[i]] = true;
+		m_order[i] = order[i];
+	}
+	BuildTables();
+}
+
+void hft::HFPermutation::BuildTables(){
+	m_fwd.clear();
+	m_inv.clear();
+	if (IsIdentity()) return;
+
+	int pos[NDIMS];
+	for (int i=0;i < NDIMS;i++){
+		pos[m_order[i]] = i;
+	}
+
+	m_fwd.assign(N_BYTES*256, 0);
+	m_inv.assign(N_BYTES*256, 0);
+	for (int b=0;b < N_BYTES;b++){
+		for (int v=0;v < 256;v++){
+			uint64_t fwd = 0, inv = 0;
+			for (int k=0;k < 8;k++){
+				if (v & (0x80 >> k)){
+					fwd |= bit_at(pos[8*b + k]);
+					inv |= bit_at(m_order[8*b + k]);
+				}
+			}
+			m_fwd[256*b + v] = fwd;
+			m_inv[256*b + v] = inv;
+		}
+	}
+}
+
+HFPermutation hft::HFPermutation::Learn(const vector<hf_t> &sample){
+	const size_t step = (sample.size() > MAX_SAMPLE) ? sample.size()/MAX_SAMPLE : 1;
+
+	vector<double> ones(NDIMS, 0);
+	vector<double> both(NDIMS*NDIMS, 0);
+	double n = 0;
+	for (size_t i=0;i < sample.size();i += step){
+		uint64_t code = sample[i].code;
+		int set[NDIMS], n_set = 0;
+		for (int p=0;p < NDIMS;p++){
+			if (code & bit_at(p)) set[n_set++] = p;
+		}
+		for (int a=0;a < n_set;a++){
+			ones[set[a]] += 1;
+			for (int b=a+1;b < n_set;b++){
+				both[set[a]*NDIMS + set[b]] += 1;
+			}
+		}
+		n += 1;
+	}
+
+	HFPermutation perm;
+	if (n < 2) return perm;
+
+	vector<double> p(NDIMS), h(NDIMS);
+	for (int i=0;i < NDIMS;i++){
+		p[i] = ones[i]/n;
+		h[i] = entropy(p[i]);
+	}
+
+	// absolute phi coefficient between every pair of bits
+	vector<double> corr(NDIMS*NDIMS, 0);
+	for (int i=0;i < NDIMS;i++){
+		for (int j=i+1;j < NDIMS;j++){
+			double denom = sqrt(p[i]*(1-p[i])*p[j]*(1-p[j]));
+			double c = (denom > 0) ? fabs(both[i*NDIMS+j]/n - p[i]*p[j])/denom : 1.0;
+			corr[i*NDIMS+j] = corr[j*NDIMS+i] = c;
+		}
+	}
+
+	vector<bool> chosen(NDIMS, false);
+	vector<double> maxcorr(NDIMS, 0);
+	for (int j=0;j < NDIMS;j++){
+		int best = -1;
+		double best_score = -1;
+		for (int i=0;i < NDIMS;i++){
+			if (chosen[i]) continue;
+			double score = h[i]*(1.0 - maxcorr[i]);
+			if (score > best_score + 1.0e-9){
+				best = i;
+				best_score = score;
+			}
+		}
+		chosen[best] = true;
+		perm.m_order[j] = best;
+		for (int i=0;i < NDIMS;i++){
+			if (corr[best*NDIMS+i] > maxcorr[i]) maxcorr[i] = corr[best*NDIMS+i];
+		}
+	}
+
+	perm.BuildTables();
+	return perm;
+}
+
+bool hft::HFPermutation::IsIdentity()const{
+	for (int i=0;i < NDIMS;i++){
+		if (m_order[i] != i) return false;
+	}
+	return true;
+}
+
+uint64_t hft::HFPermutation::Apply(const uint64_t code)const{
+	if (m_fwd.empty()) return code;
+	const uint64_t *tbl = m_fwd.data();
+	uint64_t key = 0;
+	for (int b=0;b < N_BYTES;b++){
+		key |= tbl[256*b + ((code >> (NDIMS - 8 - 8*b)) & 0xff)];
+	}
+	return key;
+}
+
+uint64_t hft::HFPermutation::Invert(const uint64_t key)const{
+	if (m_inv.empty()) return key;
+	const uint64_t *tbl = m_inv.data();
+	uint64_t code = 0;
+	for (int b=0;b < N_BYTES;b++){
+		code |= tbl[256*b + ((key >> (NDIMS - 8 - 8*b)) & 0xff)];
+	}
+	return code;
+}
+
+const int* hft::HFPermutation::GetOrder()const{
+	return m_order;
+}
+
+void hft::HFPermutation::Write(ostream &ostrm)const{
+	for (int i=0;i < NDIMS;i++){
+		uint8_t b = (uint8_t)m_order[i];
+		ostrm.write((const char*)&b, sizeof(b));
+	}
+}
+
+void hft::HFPermutation::Read(istream &istrm){
+	int order[NDIMS];
+	for (int i=0;i < NDIMS;i++){
+		uint8_t b;
+		if (!istrm.read((char*)&b, sizeof(b)))
+			throw runtime_error("unable to read permutation");
+		order[i] = b;
+	}
+	*this = HFPermutation(order);
+}
@@ -0,0 +1,102 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include "hft/hfpool.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::HFThreadPool::HFThreadPool(const int n_threads){
+	int n = (n_threads > 0) ? n_threads : (int)thread::hardware_concurrency();
+	if (n < 1) n = 1;
+
+	m_fn = NULL;
+	m_ntasks = 0;
+	m_next = 0;
+	m_generation = 0;
+	m_active = 0;
+	m_stop = false;
+	for (int i=0;i < n-1;i++){
+		m_threads.emplace_back(&HFThreadPool::WorkerLoop, this, i);
+	}
+}
+
+hft::HFThreadPool::~HFThreadPool(){
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start.notify_all();
+	for (thread &t : m_threads){
+		t.join();
+	}
+}
+
+int hft::HFThreadPool::Size()const{
+	return (int)m_threads.size() + 1;
+}
+
+void hft::HFThreadPool::RunTasks(const int worker){
+	size_t task;
+	while ((task = m_next.fetch_add(1, memory_order_relaxed)) < m_ntasks){
+		(*m_fn)(task, worker);
+	}
+}
+
+void hft::HFThreadPool::WorkerLoop(const int worker){
+	unsigned long seen = 0;
+	while (true){
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_start.wait(lock, [&]{ return m_stop || m_generation != seen; });
+			if (m_stop) return;
+			seen = m_generation;
+		}
+
+		RunTasks(worker);
+
+		lock_guard<mutex> lock(m_mutex);
+		if (--m_active == 0) m_done.notify_one();
+	}
+}
+
+void hft::HFThreadPool::ParallelFor(const size_t n_tasks, const function<void(size_t, int)> &fn){
+	if (m_threads.empty() || n_tasks <= 1){
+		for (size_t i=0;i < n_tasks;i++){
+			fn(i, Size()-1);
+		}
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_fn = &fn;
+		m_ntasks = n_tasks;
+		m_next = 0;
+		m_active = (int)m_threads.size();
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	RunTasks(Size()-1);
+
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [&]{ return m_active == 0; });
+	m_fn = NULL;
+}
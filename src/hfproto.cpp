@@ -0,0 +1,116 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cstring>
+#include <stdexcept>
+#include "hft/hfproto.hpp"
+
+using namespace std;
+using namespace hft;
+
+#define REQUEST_PAYLOAD (sizeof(long long) + sizeof(uint64_t) + sizeof(int32_t))
+#define ENTRY_SIZE (sizeof(long long) + sizeof(uint64_t))
+
+template<typename T>
+static void put(string &buf, const T val){
+	buf.append((const char*)&val, sizeof(T));
+}
+
+template<typename T>
+static T get(const char *&data){
+	T val;
+	memcpy(&val, data, sizeof(T));
+	data += sizeof(T);
+	return val;
+}
+
+static size_t decode_header(const char *data, const size_t len, hf_msg_header_t &hdr){
+	if (len < sizeof(hf_msg_header_t)) return 0;
+	memcpy(&hdr, data, sizeof(hf_msg_header_t));
+	if (hdr.length > HF_MAX_MESSAGE) throw runtime_error("message too long");
+	if (len < sizeof(hf_msg_header_t) + hdr.length) return 0;
+	return sizeof(hf_msg_header_t) + hdr.length;
+}
+
+bool hft::HasResults(const uint8_t type){
+	return (type == HF_MSG_RANGE || type == HF_MSG_RANGEFAST || type == HF_MSG_KNN);
+}
+
+void hft::EncodeRequest(const hf_request_t &req, string &buf){
+	hf_msg_header_t hdr = { REQUEST_PAYLOAD, req.req_id, req.type, 0, 0 };
+	put(buf, hdr);
+	put(buf, req.id);
+	put(buf, req.code);
+	put(buf, req.param);
+}
+
+void hft::EncodeResponse(const hf_response_t &resp, string &buf){
+	if (resp.results.size() > HF_MAX_RESULTS) throw invalid_argument("too many results for one response");
+	uint32_t length = sizeof(uint64_t);
+	if (HasResults(resp.type)) length += resp.results.size()*ENTRY_SIZE;
+
+	hf_msg_header_t hdr = { length, resp.req_id, resp.type, resp.status, 0 };
+	put(buf, hdr);
+	put(buf, resp.count);
+	if (HasResults(resp.type)){
+		for (const hf_t &e : resp.results){
+			put<long long>(buf, e.id);
+			put(buf, e.code);
+		}
+	}
+}
+
+size_t hft::DecodeRequest(const char *data, const size_t len, hf_request_t &req){
+	hf_msg_header_t hdr;
+	size_t n = decode_header(data, len, hdr);
+	if (n == 0) return 0;
+	if (hdr.length != REQUEST_PAYLOAD) throw runtime_error("bad request length");
+
+	const char *p = data + sizeof(hf_msg_header_t);
+	req.req_id = hdr.req_id;
+	req.type = hdr.type;
+	req.id = get<long long>(p);
+	req.code = get<uint64_t>(p);
+	req.param = get<int32_t>(p);
+	return n;
+}
+
+size_t hft::DecodeResponse(const char *data, const size_t len, hf_response_t &resp){
+	hf_msg_header_t hdr;
+	size_t n = decode_header(data, len, hdr);
+	if (n == 0) return 0;
+	if (hdr.length < sizeof(uint64_t)) throw runtime_error("bad response length");
+
+	const char *p = data + sizeof(hf_msg_header_t);
+	resp.req_id = hdr.req_id;
+	resp.type = hdr.type;
+	resp.status = hdr.status;
+	resp.count = get<uint64_t>(p);
+	resp.results.clear();
+	if (HasResults(hdr.type) && hdr.status == HF_STATUS_OK){
+		if (resp.count > hdr.length/ENTRY_SIZE || hdr.length != sizeof(uint64_t) + resp.count*ENTRY_SIZE)
+			throw runtime_error("bad response length");
+		resp.results.resize(resp.count);
+		for (hf_t &e : resp.results){
+			e.id = get<long long>(p);
+			e.code = get<uint64_t>(p);
+		}
+	}
+	return n;
+}
@@ -0,0 +1,343 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "hft/hfserver.hpp"
+
+using namespace std;
+using namespace hft;
+
+#define MAX_EVENTS 64
+#define READ_SIZE 65536
+
+static void throw_errno(const string &what){
+	throw runtime_error(what + ": " + strerror(errno));
+}
+
+static void set_nonblocking(const int fd){
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		throw_errno("fcntl");
+}
+
+hft::HFServer::HFServer(HFTrie &trie, const int n_workers):m_trie(trie),m_pool(n_workers){
+	m_listen_fd = -1;
+	m_stop = false;
+	m_max_results = HF_MAX_RESULTS;
+
+	m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll_fd < 0) throw_errno("epoll_create1");
+
+	m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_wake_fd < 0) throw_errno("eventfd");
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = m_wake_fd;
+	if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) < 0) throw_errno("epoll_ctl");
+}
+
+hft::HFServer::~HFServer(){
+	for (auto &c : m_conns){
+		close(c.second->fd);
+		delete c.second;
+	}
+	if (m_listen_fd >= 0) close(m_listen_fd);
+	if (!m_unix_path.empty()) unlink(m_unix_path.c_str());
+	close(m_wake_fd);
+	close(m_epoll_fd);
+}
+
+void hft::HFServer::AddListener(const int fd){
+	if (listen(fd, SOMAXCONN) < 0){
+		close(fd);
+		throw_errno("listen");
+	}
+	set_nonblocking(fd);
+	m_listen_fd = fd;
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) throw_errno("epoll_ctl");
+}
+
+void hft::HFServer::ListenUnix(const string &path){
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) throw runtime_error("socket path too long");
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) throw_errno("socket");
+	unlink(path.c_str());
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+		close(fd);
+		throw_errno("bind " + path);
+	}
+	m_unix_path = path;
+	AddListener(fd);
+}
+
+int hft::HFServer::ListenTCP(const int port){
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) throw_errno("socket");
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+		close(fd);
+		throw_errno("bind");
+	}
+
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (sockaddr*)&addr, &len);
+	AddListener(fd);
+	return ntohs(addr.sin_port);
+}
+
+void hft::HFServer::Stop(){
+	m_stop = true;
+	uint64_t one = 1;
+	ssize_t n = write(m_wake_fd, &one, sizeof(one));
+	(void)n;
+}
+
+void hft::HFServer::Accept(){
+	while (true){
+		int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) return;
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		connection_t *conn = new connection_t{ fd, "", 0, "", 0, false, false };
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = fd;
+		if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0){
+			close(fd);
+			delete conn;
+			continue;
+		}
+		m_conns[fd] = conn;
+	}
+}
+
+void hft::HFServer::ReadConnection(connection_t *conn, vector<pending_t> &batch){
+	char buf[READ_SIZE];
+	while (true){
+		ssize_t n = read(conn->fd, buf, sizeof(buf));
+		if (n > 0){
+			conn->in.append(buf, n);
+		} else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+			conn->closed = true;
+			break;
+		} else if (errno != EINTR){
+			break;
+		}
+	}
+
+	try {
+		while (true){
+			pending_t p = { conn, hf_request_t() };
+			size_t n = DecodeRequest(conn->in.data() + conn->in_pos, conn->in.size() - conn->in_pos, p.req);
+			if (n == 0) break;
+			conn->in_pos += n;
+			batch.push_back(p);
+		}
+	} catch (const runtime_error &err){
+		conn->closed = true;
+	}
+
+	if (conn->in_pos == conn->in.size()){
+		conn->in.clear();
+		conn->in_pos = 0;
+	} else if (conn->in_pos > READ_SIZE){
+		conn->in.erase(0, conn->in_pos);
+		conn->in_pos = 0;
+	}
+}
+
+void hft::HFServer::FlushConnection(connection_t *conn){
+	while (conn->out_pos < conn->out.size()){
+		ssize_t n = send(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos, MSG_NOSIGNAL);
+		if (n > 0){
+			conn->out_pos += n;
+		} else if (errno == EINTR){
+			continue;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK){
+			break;
+		} else {
+			conn->closed = true;
+			return;
+		}
+	}
+
+	bool pending = conn->out_pos < conn->out.size();
+	if (!pending){
+		conn->out.clear();
+		conn->out_pos = 0;
+	}
+	if (pending != conn->writing){
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP | (pending ? EPOLLOUT : 0);
+		ev.data.fd = conn->fd;
+		epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+		conn->writing = pending;
+	}
+}
+
+void hft::HFServer::CloseConnection(connection_t *conn){
+	epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	m_conns.erase(conn->fd);
+	delete conn;
+}
+
+void hft::HFServer::Execute(const hf_request_t &req, hf_response_t &resp){
+	resp.req_id = req.req_id;
+	resp.type = req.type;
+	resp.status = HF_STATUS_OK;
+	resp.count = 0;
+
+	switch (req.type){
+	case HF_MSG_INSERT:
+		m_trie.Insert(hf_t(req.id, req.code));
+		resp.count = 1;
+		break;
+	case HF_MSG_DELETE:
+		m_trie.Delete(hf_t(req.id, req.code));
+		break;
+	case HF_MSG_RANGE:
+		resp.results = m_trie.RangeSearch(req.code, req.param);
+		resp.count = resp.results.size();
+		break;
+	case HF_MSG_RANGEFAST:
+		resp.results = m_trie.RangeSearchFast(req.code, req.param);
+		resp.count = resp.results.size();
+		break;
+	case HF_MSG_KNN:
+		resp.results = m_trie.KNearestSearch(req.code, (req.param > 0) ? req.param : 0);
+		resp.count = resp.results.size();
+		break;
+	case HF_MSG_COUNT:
+		resp.count = m_trie.RangeSearch(req.code, req.param).size();
+		break;
+	default:
+		resp.status = HF_STATUS_BADREQUEST;
+	}
+
+	// too many to fit in a message
+	if (resp.results.size() > m_max_results.load(memory_order_relaxed)){
+		resp.status = HF_STATUS_TOOMANY;
+		vector<hf_t>().swap(resp.results);
+	}
+}
+
+void hft::HFServer::SetMaxResults(const size_t n){
+	m_max_results = min<size_t>(n, HF_MAX_RESULTS);
+}
+
+void hft::HFServer::ExecuteBatch(vector<pending_t> &batch){
+	vector<hf_response_t> responses(batch.size());
+
+	// runs of reads go to the pool; a write waits for the reads before it
+	size_t start = 0;
+	while (start < batch.size()){
+		size_t end = start;
+		while (end < batch.size() && batch[end].req.type != HF_MSG_INSERT && batch[end].req.type != HF_MSG_DELETE){
+			end++;
+		}
+		if (end > start){
+			m_pool.ParallelFor(end - start, [&](size_t task, int worker){
+				Execute(batch[start+task].req, responses[start+task]);
+			});
+		}
+		if (end < batch.size()){
+			Execute(batch[end].req, responses[end]);
+			end++;
+		}
+		start = end;
+	}
+
+	for (size_t i=0;i < batch.size();i++){
+		EncodeResponse(responses[i], batch[i].conn->out);
+	}
+}
+
+void hft::HFServer::Run(){
+	epoll_event events[MAX_EVENTS];
+	vector<pending_t> batch;
+	vector<connection_t*> touched;
+
+	while (!m_stop){
+		int n = epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			throw_errno("epoll_wait");
+		}
+
+		batch.clear();
+		touched.clear();
+		for (int i=0;i < n;i++){
+			int fd = events[i].data.fd;
+			if (fd == m_wake_fd){
+				uint64_t val;
+				ssize_t r = read(m_wake_fd, &val, sizeof(val));
+				(void)r;
+			} else if (fd == m_listen_fd){
+				Accept();
+			} else {
+				auto iter = m_conns.find(fd);
+				if (iter == m_conns.end()) continue;
+				connection_t *conn = iter->second;
+				if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+					ReadConnection(conn, batch);
+				}
+				touched.push_back(conn);
+			}
+		}
+
+		ExecuteBatch(batch);
+
+		for (connection_t *conn : touched){
+			FlushConnection(conn);
+			if (conn->closed) CloseConnection(conn);
+		}
+	}
+}
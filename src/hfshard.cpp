@@ -0,0 +1,179 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include "hft/hfshard.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::HFCoordinator::HFCoordinator():m_timeout_ms(-1){}
+
+hft::HFCoordinator::~HFCoordinator(){
+	for (HFClient *client : m_shards){
+		delete client;
+	}
+}
+
+void hft::HFCoordinator::AddShardUnix(const string &path){
+	if (m_shards.size() >= HF_MAX_SHARDS) throw invalid_argument("too many shards");
+	HFClient *client = new HFClient();
+	try {
+		client->ConnectUnix(path);
+	} catch (...){
+		delete client;
+		throw;
+	}
+	m_shards.push_back(client);
+}
+
+void hft::HFCoordinator::AddShardTCP(const int port, const string &host){
+	if (m_shards.size() >= HF_MAX_SHARDS) throw invalid_argument("too many shards");
+	HFClient *client = new HFClient();
+	try {
+		client->ConnectTCP(port, host);
+	} catch (...){
+		delete client;
+		throw;
+	}
+	m_shards.push_back(client);
+}
+
+int hft::HFCoordinator::NumShards()const{
+	return (int)m_shards.size();
+}
+
+int hft::HFCoordinator::ShardOf(const uint64_t code)const{
+	const uint64_t prefix = code >> (NDIMS - HF_SHARD_PREFIX_BITS);
+	return (int)(prefix*m_shards.size() >> HF_SHARD_PREFIX_BITS);
+}
+
+void hft::HFCoordinator::SetTimeout(const int timeout_ms){
+	m_timeout_ms = timeout_ms;
+}
+
+vector<int> hft::HFCoordinator::Reachable(const uint64_t target, const int radius)const{
+	vector<bool> reached(m_shards.size(), false);
+	const int prefix = (int)(target >> (NDIMS - HF_SHARD_PREFIX_BITS));
+	for (int p=0;p < HF_MAX_SHARDS;p++){
+		if (__builtin_popcount(p ^ prefix) <= radius)
+			reached[((uint64_t)p*m_shards.size()) >> HF_SHARD_PREFIX_BITS] = true;
+	}
+
+	vector<int> shards;
+	for (size_t i=0;i < reached.size();i++){
+		if (reached[i]) shards.push_back(i);
+	}
+	return shards;
+}
+
+hf_gather_t hft::HFCoordinator::Gather(const uint8_t type, const uint64_t target, const int param,
+									   const vector<int> &shards, const hf_shard_fn &emit){
+	if (m_shards.empty()) throw runtime_error("no shards");
+
+	vector<uint32_t> waiting(shards.size());
+	for (size_t i=0;i < shards.size();i++){
+		HFClient *client = m_shards[shards[i]];
+		waiting[i] = client->Send({ type, 0, target, param });
+		client->Flush();
+	}
+	const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(m_timeout_ms);
+
+	hf_gather_t gather;
+	gather.n_shards = shards.size();
+	size_t n_pending = shards.size();
+	vector<pollfd> fds;
+	vector<size_t> fd_shard;
+	while (n_pending > 0){
+		// take every response already read, skipping late ones to earlier queries
+		for (size_t i=0;i < shards.size();i++){
+			hf_response_t resp;
+			while (waiting[i] != 0 && m_shards[shards[i]]->Receive(resp, 0)){
+				if (resp.req_id != waiting[i]) continue;
+				waiting[i] = 0;
+				n_pending--;
+				if (resp.status != HF_STATUS_OK) throw runtime_error("shard request failed");
+				gather.count += resp.count;
+				if (emit) emit(shards[i], resp.results);
+				gather.results.insert(gather.results.end(), resp.results.begin(), resp.results.end());
+			}
+		}
+		if (n_pending == 0) break;
+
+		int wait = -1;
+		if (m_timeout_ms >= 0){
+			auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+			if (left.count() <= 0){
+				gather.n_timeouts = n_pending;
+				break;
+			}
+			wait = (int)left.count();
+		}
+
+		fds.clear();
+		for (size_t i=0;i < shards.size();i++){
+			if (waiting[i] != 0) fds.push_back({ m_shards[shards[i]]->Fd(), POLLIN, 0 });
+		}
+		if (poll(fds.data(), fds.size(), wait) < 0 && errno != EINTR)
+			throw runtime_error(string("poll: ") + strerror(errno));
+	}
+	return gather;
+}
+
+void hft::HFCoordinator::Insert(const hf_t &item){
+	if (m_shards.empty()) throw runtime_error("no shards");
+	m_shards[ShardOf(item.code)]->Insert(item);
+}
+
+void hft::HFCoordinator::Delete(const hf_t &item){
+	if (m_shards.empty()) throw runtime_error("no shards");
+	m_shards[ShardOf(item.code)]->Delete(item);
+}
+
+hf_gather_t hft::HFCoordinator::RangeSearch(const uint64_t target, const int radius, const hf_shard_fn &emit){
+	return Gather(HF_MSG_RANGE, target, radius, Reachable(target, radius), emit);
+}
+
+hf_gather_t hft::HFCoordinator::RangeSearchFast(const uint64_t target, const int radius, const hf_shard_fn &emit){
+	return Gather(HF_MSG_RANGEFAST, target, radius, Reachable(target, radius), emit);
+}
+
+hf_gather_t hft::HFCoordinator::KNearestSearch(const uint64_t target, const int k){
+	vector<int> shards(m_shards.size());
+	for (size_t i=0;i < shards.size();i++){
+		shards[i] = i;
+	}
+
+	hf_gather_t gather = Gather(HF_MSG_KNN, target, k, shards, hf_shard_fn());
+	stable_sort(gather.results.begin(), gather.results.end(), [target](const hf_t &a, const hf_t &b){
+		return __builtin_popcountll(a.code ^ target) < __builtin_popcountll(b.code ^ target);
+	});
+	if (k >= 0 && gather.results.size() > (size_t)k) gather.results.resize(k);
+	gather.count = gather.results.size();
+	return gather;
+}
+
+hf_gather_t hft::HFCoordinator::Count(const uint64_t target, const int radius){
+	return Gather(HF_MSG_COUNT, target, radius, Reachable(target, radius), hf_shard_fn());
+}
@@ -0,0 +1,65 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <sstream>
+#include "hft/hfstats.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::hf_stats_t::hf_stats_t()
+	:sample(1.0),n_entries(0),n_internal(0),n_leaves(0),internal_bytes(0),leaf_bytes(0),
+	 internal_per_level(NDIMS/CHUNKSIZE+1, 0),leaves_per_level(NDIMS/CHUNKSIZE+1, 0),
+	 entries_per_level(NDIMS/CHUNKSIZE+1, 0),leaf_occupancy(LC+2, 0),fanout(NODE_FANOUT+1, 0){}
+
+double hft::hf_stats_t::MeanDepth()const{
+	double sum = 0;
+	for (size_t l=0;l < entries_per_level.size();l++){
+		sum += (double)l*(double)entries_per_level[l];
+	}
+	return (n_entries > 0) ? sum/(double)n_entries : 0.0;
+}
+
+static void write_array(ostream &ostrm, const vector<uint64_t> &values){
+	ostrm << "[";
+	for (size_t i=0;i < values.size();i++){
+		ostrm << (i > 0 ? "," : "") << values[i];
+	}
+	ostrm << "]";
+}
+
+string hft::hf_stats_t::ToJSON()const{
+	ostringstream ss;
+	ss << "{\"sample\":" << sample << ",\"entries\":" << n_entries
+	   << ",\"internal_nodes\":" << n_internal << ",\"leaves\":" << n_leaves
+	   << ",\"mean_depth\":" << MeanDepth()
+	   << ",\"bytes\":{\"internal\":" << internal_bytes << ",\"leaf\":" << leaf_bytes << "}";
+	ss << ",\"internal_per_level\":";
+	write_array(ss, internal_per_level);
+	ss << ",\"leaves_per_level\":";
+	write_array(ss, leaves_per_level);
+	ss << ",\"entries_per_level\":";
+	write_array(ss, entries_per_level);
+	ss << ",\"leaf_occupancy\":";
+	write_array(ss, leaf_occupancy);
+	ss << ",\"fanout\":";
+	write_array(ss, fanout);
+	ss << "}";
+	return ss.str();
+}
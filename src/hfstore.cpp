@@ -0,0 +1,233 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hft/hfstore.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::HFLeafStore::HFLeafStore(const string &path, const size_t budget){
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (m_fd < 0) throw runtime_error("unable to create leaf store " + path + ": " + strerror(errno));
+	unlink(path.c_str());
+
+	m_pages_per_shard = budget/HF_STORE_PAGE/HF_STORE_SHARDS;
+	m_shards = new shard_t[HF_STORE_SHARDS];
+	for (int i=0;i < HF_STORE_SHARDS;i++){
+		m_shards[i].hand = 0;
+	}
+	m_end = 0;
+	m_live = 0;
+	m_pending_offset = 0;
+	m_reads.store(0, memory_order_relaxed);
+	m_misses.store(0, memory_order_relaxed);
+}
+
+hft::HFLeafStore::~HFLeafStore(){
+	delete[] m_shards;
+	close(m_fd);
+}
+
+HFLeafStore::shard_t& hft::HFLeafStore::ShardOf(const uint64_t page)const{
+	return m_shards[(page*0x9e3779b97f4a7c15ULL) >> 60];
+}
+
+uint32_t hft::HFLeafStore::Capacity(const size_t n){
+	uint32_t capacity = 1;
+	while (capacity < n) capacity <<= 1;
+	return capacity;
+}
+
+uint64_t hft::HFLeafStore::Allocate(const uint32_t capacity){
+	m_live++;
+	vector<uint64_t> &free_list = m_free[__builtin_ctz(capacity)];
+	if (!free_list.empty()){
+		uint64_t offset = free_list.back();
+		free_list.pop_back();
+		return offset;
+	}
+	uint64_t offset = m_end;
+	m_end += (uint64_t)capacity*sizeof(hf_t);
+	return offset;
+}
+
+void hft::HFLeafStore::Release(const uint64_t offset, const uint32_t capacity){
+	m_free[__builtin_ctz(capacity)].push_back(offset);
+	if (--m_live == 0) Reset();
+}
+
+void hft::HFLeafStore::Reset(){
+	for (int i=0;i < HF_STORE_CLASSES;i++){
+		vector<uint64_t>().swap(m_free[i]);
+	}
+	for (int i=0;i < HF_STORE_SHARDS;i++){
+		lock_guard<mutex> lock(m_shards[i].mutex);
+		m_shards[i].index.clear();
+		vector<slot_t>().swap(m_shards[i].slots);
+		m_shards[i].hand = 0;
+	}
+	m_end = 0;
+	m_pending_offset = 0;
+	m_pending.clear();
+	if (ftruncate(m_fd, 0) < 0) throw runtime_error(string("unable to truncate leaf store: ") + strerror(errno));
+}
+
+void hft::HFLeafStore::Flush(){
+	size_t done = 0;
+	while (done < m_pending.size()){
+		ssize_t res = pwrite(m_fd, m_pending.data() + done, m_pending.size() - done, m_pending_offset + done);
+		if (res < 0 && errno == EINTR) continue;
+		if (res <= 0) throw runtime_error(string("unable to write leaf store: ") + strerror(errno));
+		done += res;
+	}
+	m_pending.clear();
+}
+
+void hft::HFLeafStore::Write(const uint64_t offset, const hf_t *entries, const size_t n){
+	const char *data = (const char*)entries;
+	const size_t nbytes = n*sizeof(hf_t);
+	const uint64_t pending_end = m_pending_offset + m_pending.size();
+	if (offset >= m_pending_offset && offset + nbytes <= pending_end){
+		memcpy(m_pending.data() + (offset - m_pending_offset), data, nbytes);
+	} else if (offset == pending_end && m_pending.size() + nbytes <= HF_STORE_BATCH){
+		m_pending.insert(m_pending.end(), data, data + nbytes);
+	} else {
+		Flush();
+		m_pending_offset = offset;
+		m_pending.assign(data, data + nbytes);
+	}
+
+	// keep the resident pages current
+	for (uint64_t page=offset/HF_STORE_PAGE;page*HF_STORE_PAGE < offset + nbytes;page++){
+		shard_t &shard = ShardOf(page);
+		lock_guard<mutex> lock(shard.mutex);
+		auto iter = shard.index.find(page);
+		if (iter == shard.index.end()) continue;
+		uint64_t lo = max(offset, page*HF_STORE_PAGE), hi = min(offset + nbytes, (page+1)*HF_STORE_PAGE);
+		memcpy(shard.slots[iter->second].data.data() + (lo - page*HF_STORE_PAGE), data + (lo - offset), hi - lo);
+	}
+}
+
+void hft::HFLeafStore::ReadPage(const uint64_t page, const size_t start, const size_t nbytes, char *data){
+	m_reads.fetch_add(1, memory_order_relaxed);
+	shard_t &shard = ShardOf(page);
+	{
+		lock_guard<mutex> lock(shard.mutex);
+		auto iter = shard.index.find(page);
+		if (iter != shard.index.end()){
+			slot_t &slot = shard.slots[iter->second];
+			slot.referenced = true;
+			memcpy(data, slot.data.data() + start, nbytes);
+			return;
+		}
+	}
+
+	m_misses.fetch_add(1, memory_order_relaxed);
+	const uint64_t page_offset = page*HF_STORE_PAGE;
+	vector<char> buffer(HF_STORE_PAGE, 0);
+	size_t done = 0;
+	while (done < HF_STORE_PAGE){
+		ssize_t res = pread(m_fd, buffer.data() + done, HF_STORE_PAGE - done, page_offset + done);
+		if (res < 0 && errno == EINTR) continue;
+		if (res < 0) throw runtime_error(string("unable to read leaf store: ") + strerror(errno));
+		if (res == 0) break;
+		done += res;
+	}
+	posix_fadvise(m_fd, page_offset + HF_STORE_PAGE, HF_STORE_READAHEAD, POSIX_FADV_WILLNEED);
+
+	// writes not yet in the file
+	uint64_t lo = max(page_offset, m_pending_offset);
+	uint64_t hi = min(page_offset + HF_STORE_PAGE, m_pending_offset + m_pending.size());
+	if (lo < hi) memcpy(buffer.data() + (lo - page_offset), m_pending.data() + (lo - m_pending_offset), hi - lo);
+	memcpy(data, buffer.data() + start, nbytes);
+
+	lock_guard<mutex> lock(shard.mutex);
+	if (m_pages_per_shard == 0 || shard.index.find(page) != shard.index.end()) return;
+
+	size_t pos;
+	if (shard.slots.size() < m_pages_per_shard){
+		pos = shard.slots.size();
+		shard.slots.emplace_back();
+	} else {
+		// sweep the clock hand past recently referenced pages
+		while (shard.slots[shard.hand].referenced){
+			shard.slots[shard.hand].referenced = false;
+			shard.hand = (shard.hand + 1) % shard.slots.size();
+		}
+		pos = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.slots.size();
+		shard.index.erase(shard.slots[pos].page);
+	}
+	slot_t &slot = shard.slots[pos];
+	slot.page = page;
+	slot.data.swap(buffer);
+	slot.referenced = false;
+	shard.index[page] = pos;
+}
+
+void hft::HFLeafStore::Read(const uint64_t offset, const size_t n, vector<hf_t> &entries){
+	const size_t start = entries.size();
+	const size_t nbytes = n*sizeof(hf_t);
+	entries.resize(start + n);
+	char *data = (char*)(entries.data() + start);
+	for (uint64_t page=offset/HF_STORE_PAGE;page*HF_STORE_PAGE < offset + nbytes;page++){
+		uint64_t lo = max(offset, page*HF_STORE_PAGE), hi = min(offset + nbytes, (page+1)*HF_STORE_PAGE);
+		ReadPage(page, lo - page*HF_STORE_PAGE, hi - lo, data + (lo - offset));
+	}
+}
+
+uint64_t hft::HFLeafStore::Reads()const{
+	return m_reads.load(memory_order_relaxed);
+}
+
+uint64_t hft::HFLeafStore::Misses()const{
+	return m_misses.load(memory_order_relaxed);
+}
+
+size_t hft::HFLeafStore::Resident()const{
+	size_t n = 0;
+	for (int i=0;i < HF_STORE_SHARDS;i++){
+		lock_guard<mutex> lock(m_shards[i].mutex);
+		n += m_shards[i].slots.size()*HF_STORE_PAGE;
+	}
+	return n;
+}
+
+uint64_t hft::HFLeafStore::FileSize()const{
+	return m_end;
+}
+
+size_t hft::HFLeafStore::MemoryUsage()const{
+	size_t n = sizeof(HFLeafStore) + HF_STORE_SHARDS*sizeof(shard_t) + m_pending.capacity();
+	for (int i=0;i < HF_STORE_CLASSES;i++){
+		n += m_free[i].capacity()*sizeof(uint64_t);
+	}
+	for (int i=0;i < HF_STORE_SHARDS;i++){
+		lock_guard<mutex> lock(m_shards[i].mutex);
+		n += m_shards[i].slots.capacity()*sizeof(slot_t) + m_shards[i].slots.size()*HF_STORE_PAGE;
+		n += m_shards[i].index.size()*(2*sizeof(uint64_t) + 2*sizeof(void*));
+	}
+	return n;
+}
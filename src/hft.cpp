@@ -25,37 +25,13 @@ using namespace hft;
  *  hf_t impl basic data struct for items
  *
  **/
-unsigned long hft::hf_t::n_ops = 0;
-
-hft::hf_t::hf_t(const hf_t &other){
-	id = other.id;
-	code = other.code;
-}
-
-hf_t& hft::hf_t::operator=(const hf_t &other){
-	id = other.id;
-	code = other.code;
-	return *this;
-}
+std::atomic<unsigned long> hft::hf_t::n_ops(0);
 
 int hft::hf_t::hdistance(const uint64_t c)const{
-	hft::hf_t::n_ops++;
+	hft::hf_t::n_ops.fetch_add(1, std::memory_order_relaxed);
 	return __builtin_popcountll(code^c);
 }
 
-hft::hf_search_t::hf_search_t(const hf_search_t &other){
-	node = other.node;
-	lvl = other.lvl;
-	r = other.r;
-}
-
-hft::hf_search_t& hf_search_t::operator=(const hf_search_t &other){
-	node = other.node;
-	lvl = other.lvl;
-	r = other.r;
-	return *this;
-}
-
 uint64_t hft::create_mask(const int level){
 	uint64_t mask = 1ULL;
 	mask <<= CHUNKSIZE;
@@ -74,3 +50,23 @@ uint64_t hft::extract_index(const uint64_t code, const int level){
 
 
 
+
+void hft::sort_by_distance(std::vector<hf_t> &results, std::vector<int> &distances, const size_t start){
+	size_t offsets[NDIMS+2] = { 0 };
+	for (size_t i=start;i < distances.size();i++){
+		offsets[distances[i]+1]++;
+	}
+	for (int d=0;d <= NDIMS;d++){
+		offsets[d+1] += offsets[d];
+	}
+
+	std::vector<hf_t> sorted_results(results.size() - start);
+	std::vector<int> sorted_distances(distances.size() - start);
+	for (size_t i=start;i < distances.size();i++){
+		size_t pos = offsets[distances[i]]++;
+		sorted_results[pos] = results[i];
+		sorted_distances[pos] = distances[i];
+	}
+	std::copy(sorted_results.begin(), sorted_results.end(), results.begin() + start);
+	std::copy(sorted_distances.begin(), sorted_distances.end(), distances.begin() + start);
+}
@@ -17,34 +17,140 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 **/
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <utility>
 #include "hft/hftrie.hpp"
 
 using namespace std;
 using namespace hft;
 
+/* planner cost estimates, in nanoseconds */
+#define COST_NODE 20.0
+#define COST_ENTRY 2.0
+#define COST_SCAN 0.25
+
+/* largest radius with a specialized search kernel */
+#define KERNEL_RADIUS 12
+
+#define SCAN_BLOCK 4096
+#define SCAN_TASK (SCAN_BLOCK*16)
+
+/* nodes a bounded search visits between reads of the clock */
+#define BOUNDS_CLOCK_INTERVAL 16
+
+struct hf_op_timer_t {
+	HFMetrics *metrics;
+	hf_op_t op;
+	chrono::steady_clock::time_point start;
+	hf_op_timer_t(HFMetrics *metrics, const hf_op_t op):metrics(metrics),op(op){
+		if (metrics != NULL) start = chrono::steady_clock::now();
+	}
+	~hf_op_timer_t(){
+		if (metrics != NULL){
+			auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+			metrics->RecordLatency(op, nsecs.count());
+		}
+	}
+};
+
+/* the first level chunks of code, i.e. its root table slot at that depth */
+static inline uint64_t chunk_prefix(const uint64_t code, const int level){
+	return (level == 0) ? 0 : code >> (NDIMS - CHUNKSIZE*level);
+}
+
 hft::HFTrie::HFTrie(){
 	m_top = NULL;
+	m_metrics = NULL;
+	m_packed = false;
+	m_compact_cursor = 0;
+	m_compact_level = 0;
+	m_flat_enabled = false;
+	m_exact_enabled = false;
+	m_cache = NULL;
+	m_store = NULL;
+	m_root_bits = 0;
+	m_root_level = 0;
+	for (int l=0;l <= NDIMS/CHUNKSIZE;l++){
+		m_internal_nodes[l] = 0;
+	}
 }
 
 hft::HFTrie::~HFTrie(){
 	Clear();
+	delete m_metrics;
+	delete m_cache;
+	delete m_store;
 }
 
 
-void hft::HFTrie::Insert(const hf_t &item){
+static HFNode* build_node(const vector<hf_t> &entries, const size_t lo, const size_t hi, const int level,
+						  const bool packed, HFLeafStore *store, HFMetrics *metrics, size_t *internal_nodes){
+	if (hi - lo <= LC || level >= NDIMS/CHUNKSIZE){
+		if (metrics != NULL) metrics->AddNodes(level, 0, 1);
+		if (store != NULL){
+			HFStoredLeaf *leaf = new HFStoredLeaf(store);
+			leaf->Encode(vector<hf_t>(entries.begin() + lo, entries.begin() + hi));
+			return leaf;
+		}
+		if (packed){
+			HFPackedLeaf *leaf = new HFPackedLeaf();
+			vector<hf_t> list(entries.begin() + lo, entries.begin() + hi);
+			leaf->Encode(list, level);
+			return leaf;
+		}
+		HFLeaf *leaf = new HFListLeaf();
+		for (size_t i=lo;i < hi;i++){
+			leaf->Add(entries[i], level);
+		}
+		return leaf;
+	}
+
+	if (metrics != NULL) metrics->AddNodes(level, 1, 0);
+	internal_nodes[level]++;
+	HFInternal *internal = new HFInternal();
+	size_t start = lo;
+	while (start < hi){
+		uint64_t idx = extract_index(entries[start].code, level);
+		size_t end = start + 1;
+		while (end < hi && extract_index(entries[end].code, level) == idx) end++;
+		internal->SetChildNode(build_node(entries, start, end, level+1, packed, store, metrics, internal_nodes), idx);
+		start = end;
+	}
+	return internal;
+}
+
+void hft::HFTrie::Insert(const hf_t &entry){
+	hf_op_timer_t timer(m_metrics, HF_OP_INSERT);
+	const hf_t item(entry.id, m_perm.Apply(entry.code));
+	if (m_flat_enabled){
+		m_flat_codes.push_back(entry.code);
+		m_flat_ids.push_back(entry.id);
+	}
+	if (m_exact_enabled) m_exact.Insert(entry);
+	if (m_cache != NULL) m_cache->Invalidate(item.code);
 	if (m_top == NULL){
-		m_top = new HFLeaf();
+		if (m_metrics != NULL) m_metrics->AddNodes(0, 0, 1);
+		m_top = HFLeaf::Create(m_packed, m_store);
 		((HFLeaf*)m_top)->Add(item, 0);
+		BuildRootTable();
 		return;
 	}
 
 	int level = 0;
-	uint64_t idx;
+	uint64_t idx = 0;
+	bool created = false;
 	HFNode *prev = NULL, *node = m_top;
 	while (!node->IsLeaf()){
 		idx = extract_index(item.code, level);
 		prev = node;
-		node = ((HFInternal*)node)->GetChildNode(idx);
+		created = !((HFInternal*)node)->HasChildNode(idx);
+		if (m_metrics != NULL && created)
+			m_metrics->AddNodes(level+1, 0, 1);
+		node = ((HFInternal*)node)->GetChildNode(idx, m_packed, m_store);
 		level++;
 	}
 
@@ -54,106 +160,1150 @@ void hft::HFTrie::Insert(const hf_t &item){
 	if (node->Size() > LC && level < NDIMS/CHUNKSIZE){
 
 		HFInternal *internal = new HFInternal();
+		m_internal_nodes[level]++;
 		if (level == 0){
 			m_top = internal;
 		} else {
 			((HFInternal*)prev)->SetChildNode(internal, idx);
 		}
 		
-		vector<hf_t> list = leaf->GetEntries();
+		vector<hf_t> list;
+		leaf->GetEntries(list, level);
+		long long n_leaves = 0;
 		for (hf_t e : list){
 			idx = extract_index(e.code, level);
-			HFLeaf *nleaf = (HFLeaf*)internal->GetChildNode(idx);
-			nleaf->Add(e, level);
+			if (!internal->HasChildNode(idx)) n_leaves++;
+			HFLeaf *nleaf = (HFLeaf*)internal->GetChildNode(idx, m_packed, m_store);
+			nleaf->Add(e, level+1);
+		}
+
+		if (m_metrics != NULL){
+			m_metrics->Increment(HF_CTR_LEAF_SPLITS);
+			m_metrics->AddNodes(level, 1, -1);
+			m_metrics->AddNodes(level+1, 0, n_leaves);
 		}
 
 		delete leaf;
+		node = internal;
+		created = true;
+	}
+
+	if (created) UpdateRootTable(node, level, chunk_prefix(item.code, level));
+}
+
+void hft::HFTrie::BulkLoad(const vector<hf_t> &entries, const bool learn_permutation){
+	vector<hf_t> all;
+	CollectEntries(all);
+	ToCodeSpace(all);
+	all.insert(all.end(), entries.begin(), entries.end());
+	Build(all, learn_permutation);
+}
+
+void hft::HFTrie::BulkLoad(vector<hf_t> &&entries, const bool learn_permutation){
+	vector<hf_t> all = move(entries);
+	size_t n = all.size();
+	CollectEntries(all);
+	ToCodeSpace(all, n);
+	Build(all, learn_permutation);
+}
+
+void hft::HFTrie::Build(vector<hf_t> &all, const bool learn_permutation){
+	if (learn_permutation){
+		m_perm = HFPermutation::Learn(all);
+	}
+
+	Clear();
+	if (m_flat_enabled){
+		m_flat_codes.reserve(all.size());
+		m_flat_ids.reserve(all.size());
+		for (const hf_t &e : all){
+			m_flat_codes.push_back(e.code);
+			m_flat_ids.push_back(e.id);
+		}
+	}
+	if (m_exact_enabled){
+		m_exact.Reserve(all.size());
+		for (const hf_t &e : all){
+			m_exact.Insert(e);
+		}
+	}
+
+	for (hf_t &e : all){
+		e.code = m_perm.Apply(e.code);
+	}
+	sort(all.begin(), all.end(), [](const hf_t &a, const hf_t &b){ return a.code < b.code; });
+
+	if (!all.empty()){
+		m_top = build_node(all, 0, all.size(), 0, m_packed, m_store, m_metrics, m_internal_nodes);
+	}
+	BuildRootTable();
+}
+
+void hft::HFTrie::SetPermutation(const HFPermutation &perm){
+	vector<hf_t> all;
+	CollectEntries(all);
+	ToCodeSpace(all);
+
+	m_perm = perm;
+	Build(all, false);
+}
+
+const HFPermutation& hft::HFTrie::GetPermutation()const{
+	return m_perm;
+}
+
+void hft::HFTrie::EnableCompression(const bool enable){
+	if (enable == m_packed) return;
+
+	vector<hf_t> all;
+	CollectEntries(all);
+	ToCodeSpace(all);
+
+	m_packed = enable;
+	Build(all, false);
+}
+
+void hft::HFTrie::EnableTiering(const string &path, const size_t resident_bytes){
+	if (path.empty() && m_store == NULL) return;
+	HFLeafStore *store = path.empty() ? NULL : new HFLeafStore(path, resident_bytes);
+
+	vector<hf_t> all;
+	CollectEntries(all);
+	ToCodeSpace(all);
+
+	// the old store is only released once its leaves are gone
+	HFLeafStore *old = m_store;
+	Clear();
+	delete old;
+	m_store = store;
+	Build(all, false);
+}
+
+const HFLeafStore* hft::HFTrie::GetStore()const{
+	return m_store;
+}
+
+void hft::HFTrie::CollectEntries(vector<hf_t> &entries)const{
+	queue<hf_search_t> nodes;
+	if (m_top != NULL) nodes.push({ m_top, 0, 0 });
+
+	while (!nodes.empty()){
+		hf_search_t current = nodes.front();
+		if (current.node->IsLeaf()){
+			((HFLeaf*)current.node)->GetEntries(entries, current.lvl);
+		} else {
+			queue<HFNode*> children;
+			((HFInternal*)current.node)->GetChildNodes(children);
+			while (!children.empty()){
+				nodes.push({ children.front(), current.lvl+1, 0 });
+				children.pop();
+			}
+		}
+		nodes.pop();
 	}
 }
 
-void hft::HFTrie::Delete(const hf_t &item){
+void hft::HFTrie::ToCodeSpace(vector<hf_t> &results, const size_t start)const{
+	if (m_perm.IsIdentity()) return;
+	for (size_t i=start;i < results.size();i++){
+		results[i].code = m_perm.Invert(results[i].code);
+	}
+}
+
+/* true if every child of internal is a leaf, with n entries between them */
+static bool leaf_children(HFInternal *internal, size_t &n){
+	n = 0;
+	for (int i=0;i < NODE_FANOUT;i++){
+		if (!internal->HasChildNode(i)) continue;
+		HFNode *child = internal->GetChildNode(i);
+		if (!child->IsLeaf()) return false;
+		n += child->Size();
+	}
+	return true;
+}
+
+void hft::HFTrie::Delete(const hf_t &entry){
 	if (m_top == NULL) return;
 
+	hf_op_timer_t timer(m_metrics, HF_OP_DELETE);
+	const hf_t item(entry.id, m_perm.Apply(entry.code));
+
+	if (m_flat_enabled){
+		for (size_t i=0;i < m_flat_codes.size();){
+			if (m_flat_codes[i] == entry.code && m_flat_ids[i] == entry.id){
+				m_flat_codes[i] = m_flat_codes.back();
+				m_flat_ids[i] = m_flat_ids.back();
+				m_flat_codes.pop_back();
+				m_flat_ids.pop_back();
+			} else {
+				i++;
+			}
+		}
+	}
+	if (m_exact_enabled) m_exact.Delete(entry);
+	if (m_cache != NULL) m_cache->Invalidate(item.code);
+
 	int level = 0;
-	uint64_t idx;
+	HFInternal *path[NDIMS/CHUNKSIZE];
+	uint64_t path_idx[NDIMS/CHUNKSIZE];
 	HFNode *node = m_top;
-	while (node != NULL && !node->IsLeaf()){
-		idx = extract_index(item.code, level);
-		if (((HFInternal*)node)->HasChildNode(idx)){
-			node = ((HFInternal*)node)->GetChildNode(idx);
+	while (!node->IsLeaf()){
+		uint64_t idx = extract_index(item.code, level);
+		if (!((HFInternal*)node)->HasChildNode(idx)) return;
+		path[level] = (HFInternal*)node;
+		path_idx[level] = idx;
+		node = ((HFInternal*)node)->GetChildNode(idx);
+		level++;
+	}
+	((HFLeaf*)node)->Delete(item, level);
+
+	int changed = NDIMS;
+	HFNode *replaced = NULL;
+	if (node->Size() == 0){
+		delete node;
+		changed = level;
+		if (m_metrics != NULL) m_metrics->AddNodes(level, 0, -1);
+		if (level == 0){
+			m_top = NULL;
+			BuildRootTable();
+			return;
+		}
+		path[level-1]->SetChildNode(NULL, path_idx[level-1]);
+	}
+
+	// merge underfull parents bottom up
+	for (int l=level-1;l >= 0;l--){
+		size_t n;
+		if (!leaf_children(path[l], n) || n > LC/2) break;
+		node = Collapse(path[l], l);
+		changed = l;
+		replaced = node;
+		if (l == 0){
+			m_top = node;
 		} else {
-			node = NULL;
+			path[l-1]->SetChildNode(node, path_idx[l-1]);
 		}
-		level++;
 	}
+	if (changed != NDIMS) UpdateRootTable(replaced, changed, chunk_prefix(item.code, changed));
+}
 
-	if (node == NULL) return;
-	((HFLeaf*)node)->Delete(item, level);
-	
+HFNode* hft::HFTrie::Collapse(HFInternal *internal, const int level){
+	vector<hf_t> entries;
+	long long n_leaves = 0;
+	for (int i=0;i < NODE_FANOUT;i++){
+		if (!internal->HasChildNode(i)) continue;
+		HFLeaf *leaf = (HFLeaf*)internal->GetChildNode(i);
+		leaf->GetEntries(entries, level+1);
+		delete leaf;
+		n_leaves++;
+	}
+	delete internal;
+	m_internal_nodes[level]--;
+	if (m_metrics != NULL) m_metrics->AddNodes(level+1, 0, -n_leaves);
+
+	if (entries.empty()){
+		if (m_metrics != NULL) m_metrics->AddNodes(level, -1, 0);
+		return NULL;
+	}
+
+	if (m_metrics != NULL) m_metrics->AddNodes(level, -1, 1);
+	if (m_store != NULL){
+		HFStoredLeaf *leaf = new HFStoredLeaf(m_store);
+		leaf->Encode(entries);
+		return leaf;
+	}
+	if (m_packed){
+		HFPackedLeaf *leaf = new HFPackedLeaf();
+		leaf->Encode(entries, level);
+		return leaf;
+	}
+	HFLeaf *leaf = new HFListLeaf();
+	for (const hf_t &e : entries){
+		leaf->Add(e, level);
+	}
+	return leaf;
 }
 
-vector<hf_t> hft::HFTrie::RangeSearchFast(const uint64_t target, const int radius)const{
+HFNode* hft::HFTrie::CompactNode(HFNode *node, const int level, const uint64_t prefix,
+								 size_t &budget, bool &stopped){
+	// the ancestors of the node an earlier call stopped at are walked back
+	// down for free, so that every call gets past its cursor
+	const bool resumed = level < m_compact_level &&
+		(level == 0 || ((prefix ^ m_compact_cursor) >> (NDIMS - CHUNKSIZE*level)) == 0);
+	if (!resumed){
+		if (budget == 0){
+			m_compact_cursor = prefix;
+			m_compact_level = level;
+			stopped = true;
+			return node;
+		}
+		budget--;
+	}
+
+	if (node->IsLeaf()){
+		((HFLeaf*)node)->Shrink();
+		return node;
+	}
+
+	HFInternal *internal = (HFInternal*)node;
+	const int shift = NDIMS - CHUNKSIZE*(level+1);
+	for (int i=0;i < NODE_FANOUT;i++){
+		if (!internal->HasChildNode(i)) continue;
+
+		// skip the subtrees compacted by earlier calls
+		uint64_t child_prefix = prefix | ((uint64_t)i << shift);
+		uint64_t child_last = child_prefix | ((0x01ULL << shift) - 1);
+		if (child_last < m_compact_cursor) continue;
+
+		HFNode *child = internal->GetChildNode(i);
+		HFNode *compacted = CompactNode(child, level+1, child_prefix, budget, stopped);
+		if (compacted != child) internal->SetChildNode(compacted, i);
+		if (stopped) return internal;
+	}
+
+	size_t n;
+	if (leaf_children(internal, n) && n <= LC){
+		HFNode *collapsed = Collapse(internal, level);
+		UpdateRootTable(collapsed, level, chunk_prefix(prefix, level));
+		return collapsed;
+	}
+	return internal;
+}
+
+bool hft::HFTrie::Compact(const size_t budget){
+	size_t remaining = (budget == 0) ? SIZE_MAX : budget;
+	bool stopped = false;
+	if (m_top != NULL) m_top = CompactNode(m_top, 0, 0, remaining, stopped);
+	if (stopped) return false;
+
+	m_compact_cursor = 0;
+	m_compact_level = 0;
+	m_flat_codes.shrink_to_fit();
+	m_flat_ids.shrink_to_fit();
+	return true;
+}
+
+/**
+ * Search kernels specialized on the query radius and mode.  Radius 0 follows
+ * the single path to the target's leaf without a queue.
+ **/
+template<int R, bool FAST>
+static void search_kernel(queue<hf_search_t> &nodes, const uint64_t target,
+						  vector<hf_t> &results, vector<int> *distances){
+	if (R == 0){
+		for (;!nodes.empty();nodes.pop()){
+			HFNode *node = (HFNode*)nodes.front().node;
+			int level = nodes.front().lvl;
+			while (node != NULL && !node->IsLeaf()){
+				uint64_t idx = extract_index(target, level++);
+				HFInternal *internal = (HFInternal*)node;
+				node = internal->HasChildNode(idx) ? internal->GetChildNode(idx) : NULL;
+			}
+			if (node != NULL)
+				((HFLeaf*)node)->Search(target, extract_index(target, level), level, 0, results, distances);
+		}
+		return;
+	}
+
+	while (!nodes.empty()){
+		hf_search_t current = nodes.front();
+		uint64_t target_idx = extract_index(target, current.lvl);
+		if (current.node->IsLeaf()){
+			((HFLeaf*)current.node)->Search(target, target_idx, current.lvl, R, results, distances);
+		} else {
+			((const HFInternal*)current.node)->SearchKernel<R, FAST>(target_idx, current.lvl, current.r, nodes);
+		}
+		nodes.pop();
+	}
+}
+
+typedef void (*search_kernel_fn)(queue<hf_search_t>&, const uint64_t, vector<hf_t>&, vector<int>*);
+
+template<bool FAST, int... R>
+static constexpr array<search_kernel_fn, sizeof...(R)> make_kernels(integer_sequence<int, R...>){
+	return {{ search_kernel<R, FAST>... }};
+}
+
+static constexpr auto exact_kernels = make_kernels<false>(make_integer_sequence<int, KERNEL_RADIUS+1>());
+static constexpr auto fast_kernels = make_kernels<true>(make_integer_sequence<int, KERNEL_RADIUS+1>());
+
+static void search_nodes(queue<hf_search_t> &nodes, const uint64_t target, const int radius,
+						 const bool fast, vector<hf_t> &results, vector<int> *distances=NULL){
+	if (radius >= 0 && radius <= KERNEL_RADIUS){
+		(fast ? fast_kernels : exact_kernels)[radius](nodes, target, results, distances);
+		return;
+	}
+
+	while (!nodes.empty()){
+		hf_search_t current = nodes.front();
+		uint64_t target_idx = extract_index(target, current.lvl);
+		if (current.node->IsLeaf()){
+			HFLeaf *leaf = (HFLeaf*)current.node;
+			leaf->Search(target, target_idx, current.lvl, radius, results, distances);
+		} else if (fast){
+			HFInternal *internal = (HFInternal*)current.node;
+			internal->SearchFast(target, target_idx, current.lvl, current.r, nodes);
+		} else {
+			HFInternal *internal = (HFInternal*)current.node;
+			internal->Search(target, target_idx, current.lvl, current.r, nodes);
+		}
+		nodes.pop();
+	}
+}
+
+void hft::HFTrie::SetRootBits(const int bits){
+	if (bits != HF_ROOT_AUTO && (bits < 0 || bits > HF_ROOT_MAX_BITS || bits % CHUNKSIZE != 0))
+		throw invalid_argument("bad root table width");
+	m_root_bits = bits;
+	BuildRootTable();
+}
+
+int hft::HFTrie::GetRootBits()const{
+	return CHUNKSIZE*m_root_level;
+}
+
+int hft::HFTrie::AutoRootLevel()const{
+	int level = 0;
+	while (level < HF_ROOT_MAX_BITS/CHUNKSIZE &&
+		   2*m_internal_nodes[level+1] >= (0x01ULL << (CHUNKSIZE*(level+1)))) level++;
+	return level;
+}
+
+void hft::HFTrie::BuildRootTable(){
+	const int level = (m_root_bits == HF_ROOT_AUTO) ? AutoRootLevel() : m_root_bits/CHUNKSIZE;
+
+	m_root_level = level;
+	if (level == 0){
+		vector<hf_root_slot_t>().swap(m_root_table);
+		return;
+	}
+	const size_t n_slots = 0x01ULL << (CHUNKSIZE*level);
+	if (m_root_table.size() != n_slots) vector<hf_root_slot_t>(n_slots).swap(m_root_table);
+	fill(m_root_table.begin(), m_root_table.end(), hf_root_slot_t{ NULL, 0 });
+	if (m_metrics != NULL) m_metrics->Increment(HF_CTR_ROOT_SLOTS, n_slots);
+	if (m_top != NULL) FillRootTable(m_top, 0, 0);
+}
+
+void hft::HFTrie::FillRootTable(const HFNode *node, const int level, const uint64_t prefix){
+	if (level == m_root_level || node->IsLeaf()){
+		// a leaf above the table depth covers all slots that share its prefix
+		const int shift = CHUNKSIZE*(m_root_level - level);
+		for (uint64_t s=prefix << shift;s < (prefix + 1) << shift;s++){
+			m_root_table[s] = { node, level };
+		}
+		return;
+	}
+
+	HFInternal *internal = (HFInternal*)node;
+	for (int i=0;i < NODE_FANOUT;i++){
+		if (internal->HasChildNode(i))
+			FillRootTable(internal->GetChildNode(i), level+1, (prefix << CHUNKSIZE) | i);
+	}
+}
+
+void hft::HFTrie::UpdateRootTable(const HFNode *node, const int level, const uint64_t prefix){
+	if (m_root_bits == HF_ROOT_AUTO){
+		// a level is kept until it falls to a quarter full, so that a trie
+		// hovering at the threshold does not rebuild the table on every write
+		const int auto_level = AutoRootLevel();
+		if (auto_level > m_root_level || (auto_level < m_root_level &&
+			4*m_internal_nodes[m_root_level] < (0x01ULL << (CHUNKSIZE*m_root_level)))){
+			BuildRootTable();
+			return;
+		}
+	}
+	if (m_root_level == 0 || level > m_root_level) return;
+
+	// nodes below the table depth are reached through their ancestor's slot
+	const int shift = CHUNKSIZE*(m_root_level - level);
+	fill(m_root_table.begin() + (prefix << shift), m_root_table.begin() + ((prefix + 1) << shift),
+		 hf_root_slot_t{ NULL, 0 });
+	if (m_metrics != NULL) m_metrics->Increment(HF_CTR_ROOT_SLOTS, 0x01ULL << shift);
+	if (node != NULL) FillRootTable(node, level, prefix);
+}
+
+/**
+ * Push the node of slot and of every slot that differs from it in more bits
+ * from pos on, while within radius of the target prefix.  For a fast search,
+ * slots differing in more than one bit of a chunk are skipped, as the nodes
+ * would have been.  A node above the table depth is only pushed from the slot
+ * that matches the target below its level, so that it is visited once and at
+ * its own distance.
+ **/
+static void seed_slots(const vector<hf_root_slot_t> &table, const int bits, const uint64_t prefix,
+					   const uint64_t slot, const int pos, const int d, const int radius,
+					   const bool fast, queue<hf_search_t> &nodes){
+	const hf_root_slot_t &s = table[slot];
+	const uint64_t below = (0x01ULL << (bits - CHUNKSIZE*s.lvl)) - 1;
+	if (s.node != NULL && ((slot ^ prefix) & below) == 0){
+		nodes.push({ s.node, s.lvl, radius - d });
+	}
+	if (d == radius) return;
+	for (int b=pos;b < bits;b++){
+		int next = fast ? (b/CHUNKSIZE + 1)*CHUNKSIZE : b+1;
+		seed_slots(table, bits, prefix, slot ^ (0x01ULL << b), next, d+1, radius, fast, nodes);
+	}
+}
+
+void hft::HFTrie::SeedSearch(const uint64_t target, const int radius, const bool fast,
+							 queue<hf_search_t> &nodes)const{
+	if (m_root_level == 0){
+		if (m_top != NULL) nodes.push({ m_top, 0, radius });
+		return;
+	}
+
+	const int bits = CHUNKSIZE*m_root_level;
+	const uint64_t prefix = target >> (NDIMS - bits);
+	if (radius < bits || fast){
+		seed_slots(m_root_table, bits, prefix, prefix, 0, 0, radius, fast, nodes);
+		return;
+	}
+
+	// every slot is within radius
+	for (uint64_t slot=0;slot < m_root_table.size();slot++){
+		const hf_root_slot_t &s = m_root_table[slot];
+		const uint64_t below = (0x01ULL << (bits - CHUNKSIZE*s.lvl)) - 1;
+		if (s.node != NULL && ((slot ^ prefix) & below) == 0){
+			nodes.push({ s.node, s.lvl, radius - __builtin_popcountll(slot ^ prefix) });
+		}
+	}
+}
+
+vector<hf_t> hft::HFTrie::RangeSearchFast(const uint64_t code, const int radius)const{
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCHFAST);
 	vector<hf_t> results;
+	if (radius == 0 && m_exact_enabled){
+		m_exact.Lookup(code, results);
+	} else {
+		const uint64_t target = m_perm.Apply(code);
+		uint64_t stamp = 0;
+		if (m_cache == NULL || !FromCache(code, target, radius, HF_CACHE_FAST, results, stamp)){
+			queue<hf_search_t> nodes;
+			SeedSearch(target, radius, true, nodes);
+			search_nodes(nodes, target, radius, true, results);
+
+			ToCodeSpace(results);
+			if (m_cache != NULL) m_cache->Put(code, radius, HF_CACHE_FAST, results, 0, stamp);
+		}
+	}
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size());
+	return results;
+}
+
+vector<hf_t> hft::HFTrie::RangeSearch(const uint64_t code, const int radius)const{
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCH);
+	vector<hf_t> results;
+	if (radius == 0 && m_exact_enabled){
+		m_exact.Lookup(code, results);
+	} else {
+		const uint64_t target = m_perm.Apply(code);
+		uint64_t stamp = 0;
+		if (m_cache == NULL || !FromCache(code, target, radius, HF_CACHE_EXACT, results, stamp)){
+			queue<hf_search_t> nodes;
+			SeedSearch(target, radius, false, nodes);
+			search_nodes(nodes, target, radius, false, results);
+
+			ToCodeSpace(results);
+			if (m_cache != NULL) m_cache->Put(code, radius, HF_CACHE_EXACT, results, 0, stamp);
+		}
+	}
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size());
+	return results;
+}
+
+/* counting sort over the distances 0..NDIMS of the entries from start on */
+void hft::HFTrie::RangeSearchFast(const uint64_t code, const int radius, vector<hf_t> &results,
+								  vector<int> &distances, const bool sorted)const{
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCHFAST);
+	const size_t start = results.size();
+	distances.resize(start);
+
+	if (radius == 0 && m_exact_enabled){
+		m_exact.Lookup(code, results);
+		distances.resize(results.size(), 0);
+		if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+		return;
+	}
+
+	const uint64_t target = m_perm.Apply(code);
+	uint64_t stamp = 0;
+	if (m_cache != NULL && FromCache(code, target, radius, HF_CACHE_FAST, results, stamp)){
+		for (size_t i=start;i < results.size();i++){
+			distances.push_back(__builtin_popcountll(results[i].code ^ code));
+		}
+		if (sorted) sort_by_distance(results, distances, start);
+		if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+		return;
+	}
 
 	queue<hf_search_t> nodes;
+	SeedSearch(target, radius, true, nodes);
+	search_nodes(nodes, target, radius, true, results, &distances);
+
+	if (sorted) sort_by_distance(results, distances, start);
+	ToCodeSpace(results, start);
+	if (m_cache != NULL) m_cache->Put(code, radius, HF_CACHE_FAST, results, start, stamp);
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+}
+
+void hft::HFTrie::RangeSearch(const uint64_t code, const int radius, vector<hf_t> &results,
+							  vector<int> &distances, const bool sorted)const{
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCH);
+	const size_t start = results.size();
+	distances.resize(start);
+
+	if (radius == 0 && m_exact_enabled){
+		m_exact.Lookup(code, results);
+		distances.resize(results.size(), 0);
+		if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+		return;
+	}
 
-	if (m_top != NULL){
+	const uint64_t target = m_perm.Apply(code);
+	uint64_t stamp = 0;
+	if (m_cache != NULL && FromCache(code, target, radius, HF_CACHE_EXACT, results, stamp)){
+		for (size_t i=start;i < results.size();i++){
+			distances.push_back(__builtin_popcountll(results[i].code ^ code));
+		}
+		if (sorted) sort_by_distance(results, distances, start);
+		if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+		return;
+	}
+
+	queue<hf_search_t> nodes;
+	SeedSearch(target, radius, false, nodes);
+	search_nodes(nodes, target, radius, false, results, &distances);
+
+	if (sorted) sort_by_distance(results, distances, start);
+	ToCodeSpace(results, start);
+	if (m_cache != NULL) m_cache->Put(code, radius, HF_CACHE_EXACT, results, start, stamp);
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+}
+
+vector<hf_t> hft::HFTrie::RangeSearchMasked(const uint64_t code, const uint64_t care_mask, const int radius)const{
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCHMASKED);
+	vector<hf_t> results;
+	const uint64_t target = m_perm.Apply(code);
+	const uint64_t mask = m_perm.Apply(care_mask);
+
+	queue<hf_search_t> nodes;
+	if (m_top != NULL && radius >= 0){
 		nodes.push({ m_top, 0, radius });
 	}
 
-	int level = 0;
+	vector<hf_t> entries;
 	while (!nodes.empty()){
-		uint64_t target_idx = extract_index(target, level);
-		queue<hf_search_t> next_nodes;
-
-		while (!nodes.empty()){
-			hf_search_t current = nodes.front();
-			if (current.node->IsLeaf()){
-				HFLeaf *leaf = (HFLeaf*)current.node;
-				leaf->Search(target, target_idx, current.lvl, radius, results);
-			} else {
-				HFInternal *internal = (HFInternal*)current.node;
-				internal->SearchFast(target, target_idx, current.lvl, current.r, next_nodes);
+		hf_search_t current = nodes.front();
+		nodes.pop();
+		if (current.node->IsLeaf()){
+			entries.clear();
+			((const HFLeaf*)current.node)->GetEntries(entries, current.lvl);
+			for (const hf_t &e : entries){
+				if (__builtin_popcountll((e.code ^ target) & mask) <= radius) results.push_back(e);
 			}
-			nodes.pop();
+			hf_t::n_ops.fetch_add(entries.size(), memory_order_relaxed);
+			continue;
+		}
+
+		HFInternal *internal = (HFInternal*)current.node;
+		const uint64_t target_idx = extract_index(target, current.lvl);
+		const uint64_t mask_idx = extract_index(mask, current.lvl);
+		for (int i=0;i < NODE_FANOUT;i++){
+			if (!internal->HasChildNode(i)) continue;
+			int d = __builtin_popcountll((target_idx ^ i) & mask_idx);
+			if (d <= current.r) nodes.push({ internal->GetChildNode(i), current.lvl+1, current.r - d });
 		}
-		nodes = move(next_nodes);
-		level++;
 	}
+
+	ToCodeSpace(results);
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size());
 	return results;
 }
 
-vector<hf_t> hft::HFTrie::RangeSearch(const uint64_t target, const int radius)const{
+hft::HFContinuation::HFContinuation():m_target(0),m_radius(0),m_fast(false){
+	for (int i=0;i < NDIMS;i++){
+		m_order[i] = i;
+	}
+}
+
+bool hft::HFContinuation::Done()const{
+	return m_pending.empty();
+}
+
+size_t hft::HFContinuation::Pending()const{
+	return m_pending.size();
+}
+
+/* node of a bounded search, with the key prefix that leads to it */
+struct hf_bounded_t {
+	const HFNode *node;
+	uint64_t prefix;
+	int lvl;
+	int r;
+};
+
+bool hft::HFTrie::SearchBounded(HFContinuation &cont, const hf_bounds_t &bounds, vector<hf_t> &results)const{
+	const uint64_t target = cont.m_target;
+	const int radius = cont.m_radius;
+	const auto deadline = chrono::steady_clock::now() + chrono::microseconds(bounds.max_usecs);
+
+	size_t n_ops = 0, n_visited = 0;
+	auto in_bounds = [&]()->bool{
+		if (n_visited == 0) return true;
+		if (bounds.max_ops > 0 && n_ops >= bounds.max_ops) return false;
+		return bounds.max_usecs <= 0 || n_visited % BOUNDS_CLOCK_INTERVAL != 0
+			|| chrono::steady_clock::now() < deadline;
+	};
+
+	// one pending subtree at a time is expanded, so nodes only holds part of the frontier
+	queue<hf_bounded_t> nodes;
+	vector<hf_t> entries;
+	while ((!nodes.empty() || !cont.m_pending.empty()) && in_bounds()){
+		if (nodes.empty()){
+			HFContinuation::pending_t p = cont.m_pending.back();
+			cont.m_pending.pop_back();
+			n_ops++;
+
+			const HFNode *node = m_top;
+			int lvl = 0;
+			while (node != NULL && lvl < p.lvl && !node->IsLeaf()){
+				HFInternal *internal = (HFInternal*)node;
+				uint64_t idx = extract_index(p.prefix, lvl++);
+				node = internal->HasChildNode(idx) ? internal->GetChildNode(idx) : NULL;
+			}
+			if (node == NULL) continue;
+			if (lvl == p.lvl){
+				nodes.push({ node, p.prefix, p.lvl, p.r });
+				continue;
+			}
+
+			// deletes merged the subtree into a shallower leaf: search the part of it under prefix
+			entries.clear();
+			((const HFLeaf*)node)->GetEntries(entries, lvl);
+			const int shift = NDIMS - CHUNKSIZE*p.lvl;
+			for (const hf_t &e : entries){
+				if (((e.code ^ p.prefix) >> shift) == 0 && __builtin_popcountll(e.code ^ target) <= radius)
+					results.push_back(e);
+			}
+			n_ops += entries.size();
+			n_visited++;
+			continue;
+		}
+
+		hf_bounded_t current = nodes.front();
+		nodes.pop();
+		n_visited++;
+		if (current.node->IsLeaf()){
+			HFLeaf *leaf = (HFLeaf*)current.node;
+			leaf->Search(target, extract_index(target, current.lvl), current.lvl, radius, results);
+			n_ops += leaf->Size();
+			continue;
+		}
+
+		n_ops++;
+		HFInternal *internal = (HFInternal*)current.node;
+		const uint64_t target_idx = extract_index(target, current.lvl);
+		const int max_d = (cont.m_fast && current.r > 1) ? 1 : current.r;
+		const int shift = NDIMS - CHUNKSIZE*(current.lvl+1);
+		for (int i=0;i < NODE_FANOUT;i++){
+			if (!internal->HasChildNode(i)) continue;
+			int d = __builtin_popcountll(target_idx ^ i);
+			if (d <= max_d){
+				nodes.push({ internal->GetChildNode(i), current.prefix | ((uint64_t)i << shift),
+							 current.lvl+1, current.r - d });
+			}
+		}
+	}
+
+	for (;!nodes.empty();nodes.pop()){
+		cont.m_pending.push_back({ nodes.front().prefix, nodes.front().lvl, nodes.front().r });
+	}
+	return cont.m_pending.empty();
+}
+
+bool hft::HFTrie::RangeSearchBounded(const uint64_t code, const int radius, const hf_bounds_t &bounds,
+									 vector<hf_t> &results, HFContinuation &cont, const bool fast)const{
+	cont.m_target = m_perm.Apply(code);
+	cont.m_radius = radius;
+	cont.m_fast = fast;
+	copy(m_perm.GetOrder(), m_perm.GetOrder() + NDIMS, cont.m_order);
+	cont.m_pending.clear();
+	if (radius >= 0) cont.m_pending.push_back({ 0, 0, radius });
+	return Resume(cont, bounds, results);
+}
+
+bool hft::HFTrie::Resume(HFContinuation &cont, const hf_bounds_t &bounds, vector<hf_t> &results)const{
+	if (!equal(cont.m_order, cont.m_order + NDIMS, m_perm.GetOrder()))
+		throw invalid_argument("permutation changed since the search started");
+
+	hf_op_timer_t timer(m_metrics, cont.m_fast ? HF_OP_RANGESEARCHFAST : HF_OP_RANGESEARCH);
+	const size_t start = results.size();
+	bool done = SearchBounded(cont, bounds, results);
+
+	ToCodeSpace(results, start);
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size() - start);
+	return done;
+}
+
+vector<hf_t> hft::HFTrie::RangeSearchParallel(const uint64_t code, const int radius, HFThreadPool &pool)const{
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCHPARALLEL);
 	vector<hf_t> results;
+	const uint64_t target = m_perm.Apply(code);
 
+	// expand the frontier breadth first until there are enough subtrees to keep every worker busy
+	const size_t n_subtrees = 8*pool.Size();
 	queue<hf_search_t> nodes;
-
-	if (m_top != NULL){
-		nodes.push({ m_top, 0, radius });
+	SeedSearch(target, radius, false, nodes);
+	while (!nodes.empty() && nodes.size() < n_subtrees){
+		hf_search_t current = nodes.front();
+		uint64_t target_idx = extract_index(target, current.lvl);
+		if (current.node->IsLeaf()){
+			((HFLeaf*)current.node)->Search(target, target_idx, current.lvl, radius, results);
+		} else {
+			((HFInternal*)current.node)->Search(target, target_idx, current.lvl, current.r, nodes);
+		}
+		nodes.pop();
 	}
 
-	int level = 0;
+	vector<hf_search_t> frontier;
+	frontier.reserve(nodes.size());
 	while (!nodes.empty()){
-		uint64_t target_idx = extract_index(target, level);
-		queue<hf_search_t> next_nodes;
-
-		while (!nodes.empty()){
-			hf_search_t current = nodes.front();
-			if (current.node->IsLeaf()){
-				HFLeaf *leaf = (HFLeaf*)current.node;
-				leaf->Search(target, target_idx, current.lvl, radius, results);
+		frontier.push_back(nodes.front());
+		nodes.pop();
+	}
+
+	vector<vector<hf_t>> partial(pool.Size());
+	pool.ParallelFor(frontier.size(), [&](size_t task, int worker){
+		queue<hf_search_t> subtree;
+		subtree.push(frontier[task]);
+		search_nodes(subtree, target, radius, false, partial[worker]);
+	});
+
+	for (vector<hf_t> &part : partial){
+		results.insert(results.end(), part.begin(), part.end());
+	}
+
+	ToCodeSpace(results);
+	if (m_metrics != NULL) m_metrics->RecordResults(results.size());
+	return results;
+}
+
+/**
+ * Join of the subtrees a and b, both at level lvl, whose prefixes are radius - r
+ * apart.  Pairs of internal nodes push their child pairs within r, leaves are
+ * matched against the other side with a range search.  For a self join (a == b),
+ * only child pairs i <= j are visited so that each pair of entries is found once.
+ **/
+struct hf_join_t {
+	const HFNode *a;
+	const HFNode *b;
+	int lvl;
+	int r;
+};
+
+static void join_step(const hf_join_t &current, const int radius, const HFPermutation &perm,
+					  const hf_pair_fn &emit, vector<hf_join_t> &pairs){
+	HFNode *a = (HFNode*)current.a, *b = (HFNode*)current.b;
+	const bool self = (a == b);
+
+	if (!a->IsLeaf() && !b->IsLeaf()){
+		HFInternal *ia = (HFInternal*)a, *ib = (HFInternal*)b;
+		for (int i=0;i < NODE_FANOUT;i++){
+			if (!ia->HasChildNode(i)) continue;
+			for (int j=(self ? i : 0);j < NODE_FANOUT;j++){
+				int d = __builtin_popcount(i^j);
+				if (d > current.r || !ib->HasChildNode(j)) continue;
+				pairs.push_back({ ia->GetChildNode(i), ib->GetChildNode(j), current.lvl+1, current.r - d });
+			}
+		}
+		return;
+	}
+
+	// at least one side is a leaf: search the other side for each of its entries
+	const bool a_leaf = a->IsLeaf();
+	vector<hf_t> entries, results;
+	vector<int> distances;
+	((HFLeaf*)(a_leaf ? a : b))->GetEntries(entries, current.lvl);
+	for (size_t i=0;i < entries.size();i++){
+		const hf_t &e = entries[i];
+		results.clear();
+		distances.clear();
+		if (self){
+			for (size_t j=i+1;j < entries.size();j++){
+				int d = e.hdistance(entries[j].code);
+				if (d <= radius){
+					results.push_back(entries[j]);
+					distances.push_back(d);
+				}
+			}
+		} else {
+			queue<hf_search_t> nodes;
+			nodes.push({ a_leaf ? b : a, current.lvl, current.r });
+			search_nodes(nodes, e.code, radius, false, results, &distances);
+		}
+
+		hf_t x(e.id, perm.Invert(e.code));
+		for (size_t j=0;j < results.size();j++){
+			hf_t y(results[j].id, perm.Invert(results[j].code));
+			if (a_leaf){
+				emit(x, y, distances[j]);
 			} else {
-				HFInternal *internal = (HFInternal*)current.node;
-				internal->Search(target, target_idx, current.lvl, current.r, next_nodes);
+				emit(y, x, distances[j]);
 			}
-			nodes.pop();
 		}
-		nodes = move(next_nodes);
-		level++;
+	}
+}
+
+static void join_nodes(const HFNode *a, const HFNode *b, const int radius, const HFPermutation &perm,
+					   const hf_pair_fn &emit, HFThreadPool *pool){
+	if (a == NULL || b == NULL || radius < 0) return;
+
+	vector<hf_join_t> pairs = { { a, b, 0, radius } };
+	if (pool != NULL && pool->Size() > 1){
+		// expand breadth first until there are enough pairs to keep every worker busy
+		const size_t n_pairs = 8*pool->Size();
+		size_t head = 0;
+		while (head < pairs.size() && pairs.size() - head < n_pairs){
+			hf_join_t current = pairs[head++];
+			join_step(current, radius, perm, emit, pairs);
+		}
+		vector<hf_join_t> frontier(pairs.begin() + head, pairs.end());
+		pool->ParallelFor(frontier.size(), [&](size_t task, int worker){
+			vector<hf_join_t> stack = { frontier[task] };
+			while (!stack.empty()){
+				hf_join_t current = stack.back();
+				stack.pop_back();
+				join_step(current, radius, perm, emit, stack);
+			}
+		});
+		return;
+	}
+
+	while (!pairs.empty()){
+		hf_join_t current = pairs.back();
+		pairs.pop_back();
+		join_step(current, radius, perm, emit, pairs);
+	}
+}
+
+void hft::HFTrie::SimilarityJoin(const HFTrie &other, const int radius, const hf_pair_fn &emit,
+								 HFThreadPool *pool)const{
+	const int *order = m_perm.GetOrder(), *other_order = other.m_perm.GetOrder();
+	if (!equal(order, order + NDIMS, other_order))
+		throw invalid_argument("tries use different permutations");
+	join_nodes(m_top, other.m_top, radius, m_perm, emit, pool);
+}
+
+void hft::HFTrie::SelfJoin(const int radius, const hf_pair_fn &emit, HFThreadPool *pool)const{
+	join_nodes(m_top, m_top, radius, m_perm, emit, pool);
+}
+
+vector<hf_t> hft::HFTrie::KNearestSearch(const uint64_t code, const size_t k)const{
+	const uint64_t target = m_perm.Apply(code);
+	// bypasses the cache, which would otherwise fill with one entry per radius tried
+	return knearest_search(k, [this, code, target](const int radius, vector<hf_t> &results, vector<int> &distances){
+		if (radius == 0 && m_exact_enabled){
+			m_exact.Lookup(code, results);
+			distances.resize(results.size(), 0);
+			return;
+		}
+		queue<hf_search_t> nodes;
+		SeedSearch(target, radius, false, nodes);
+		search_nodes(nodes, target, radius, false, results, &distances);
+		sort_by_distance(results, distances, 0);
+		ToCodeSpace(results, 0);
+	});
+}
+
+void hft::HFTrie::EnableFlatScan(const bool enable){
+	m_flat_enabled = enable;
+	m_flat_codes.clear();
+	m_flat_ids.clear();
+	m_flat_codes.shrink_to_fit();
+	m_flat_ids.shrink_to_fit();
+	if (!enable) return;
+
+	vector<hf_t> all;
+	CollectEntries(all);
+	ToCodeSpace(all);
+	m_flat_codes.reserve(all.size());
+	m_flat_ids.reserve(all.size());
+	for (const hf_t &e : all){
+		m_flat_codes.push_back(e.code);
+		m_flat_ids.push_back(e.id);
+	}
+}
+
+void hft::HFTrie::EnableExactTable(const bool enable){
+	m_exact_enabled = enable;
+	m_exact.Clear();
+	if (!enable) return;
+
+	vector<hf_t> all;
+	CollectEntries(all);
+	ToCodeSpace(all);
+	m_exact.Reserve(all.size());
+	for (const hf_t &e : all){
+		m_exact.Insert(e);
+	}
+}
+
+bool hft::HFTrie::Contains(const uint64_t code)const{
+	if (m_exact_enabled) return m_exact.Contains(code);
+	return !RangeSearch(code, 0).empty();
+}
+
+vector<bool> hft::HFTrie::Contains(const vector<uint64_t> &codes)const{
+	if (m_exact_enabled) return m_exact.Contains(codes);
+
+	vector<bool> found(codes.size());
+	for (size_t i=0;i < codes.size();i++){
+		found[i] = Contains(codes[i]);
+	}
+	return found;
+}
+
+vector<vector<hf_t>> hft::HFTrie::Lookup(const vector<uint64_t> &codes)const{
+	if (m_exact_enabled) return m_exact.Lookup(codes);
+
+	vector<vector<hf_t>> results(codes.size());
+	for (size_t i=0;i < codes.size();i++){
+		results[i] = RangeSearch(codes[i], 0);
+	}
+	return results;
+}
+
+/* fraction of b bit prefixes within distance r of a given prefix */
+static double prefix_ball(const int b, const int r){
+	double term = 1.0, sum = 0.0;
+	for (int i=0;i <= min(b, r);i++){
+		sum += term;
+		term *= (double)(b - i)/(double)(i + 1);
+	}
+	return sum/ldexp(1.0, b);
+}
+
+double hft::HFTrie::EstimateSearchCost(const int radius)const{
+	double nodes = 0;
+	int depth = 0;
+	for (int l=0;l <= NDIMS/CHUNKSIZE;l++){
+		if (m_internal_nodes[l] == 0) continue;
+		nodes += (double)m_internal_nodes[l]*prefix_ball(CHUNKSIZE*l, radius);
+		depth = l + 1;
+	}
+	double entries = (double)m_flat_codes.size()*prefix_ball(CHUNKSIZE*depth, radius);
+	return COST_NODE*nodes + COST_ENTRY*entries;
+}
+
+/**
+ * Distance of a block of codes to target.  Compiled for avx512 (vectorized
+ * popcount), scalar popcnt and generic code; the widest one the cpu supports
+ * is picked at startup.
+ **/
+#define DISTANCE_KERNEL												\
+	for (size_t i=0;i < n;i++){										\
+		dists[i] = (uint8_t)__builtin_popcountll(codes[i]^target);	\
+	}
+
+typedef void (*distance_fn)(const uint64_t*, const size_t, const uint64_t, uint8_t*);
+
+static void distance_block_generic(const uint64_t *codes, const size_t n, const uint64_t target, uint8_t *dists){
+	DISTANCE_KERNEL
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx512f,avx512vl,avx512bw,avx512vpopcntdq")))
+static void distance_block_avx512(const uint64_t *codes, const size_t n, const uint64_t target, uint8_t *dists){
+	DISTANCE_KERNEL
+}
+
+__attribute__((target("popcnt")))
+static void distance_block_popcnt(const uint64_t *codes, const size_t n, const uint64_t target, uint8_t *dists){
+	DISTANCE_KERNEL
+}
+
+static distance_fn select_distance_block(){
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512vpopcntdq")) return distance_block_avx512;
+	if (__builtin_cpu_supports("popcnt")) return distance_block_popcnt;
+	return distance_block_generic;
+}
+#else
+static distance_fn select_distance_block(){
+	return distance_block_generic;
+}
+#endif
+
+static const distance_fn distance_block = select_distance_block();
+
+static void scan_range(const uint64_t *codes, const hf_id_t *ids, const size_t lo, const size_t hi,
+					   const uint64_t target, const int radius, vector<hf_t> &results){
+	uint8_t dists[SCAN_BLOCK];
+	for (size_t b=lo;b < hi;b += SCAN_BLOCK){
+		size_t n = min((size_t)SCAN_BLOCK, hi - b);
+		distance_block(codes + b, n, target, dists);
+		for (size_t i=0;i < n;i++){
+			if (dists[i] <= radius) results.push_back({ ids[b+i], codes[b+i] });
+		}
+	}
+}
+
+void hft::HFTrie::FlatScan(const uint64_t target, const int radius, HFThreadPool *pool,
+						   vector<hf_t> &results)const{
+	const size_t n = m_flat_codes.size();
+	if (pool == NULL || pool->Size() == 1 || n <= SCAN_TASK){
+		scan_range(m_flat_codes.data(), m_flat_ids.data(), 0, n, target, radius, results);
+		return;
+	}
+
+	vector<vector<hf_t>> partial(pool->Size());
+	pool->ParallelFor((n + SCAN_TASK - 1)/SCAN_TASK, [&](size_t task, int worker){
+		size_t lo = task*SCAN_TASK;
+		scan_range(m_flat_codes.data(), m_flat_ids.data(), lo, min(lo + SCAN_TASK, n),
+				   target, radius, partial[worker]);
+	});
+	for (vector<hf_t> &part : partial){
+		results.insert(results.end(), part.begin(), part.end());
+	}
+}
+
+bool hft::HFTrie::FromCache(const uint64_t code, const uint64_t target, const int radius, const hf_cache_mode_t mode,
+							vector<hf_t> &results, uint64_t &stamp)const{
+	stamp = m_cache->Stamp();
+	bool hit = m_cache->Get(code, target, radius, mode, results);
+	if (m_metrics != NULL) m_metrics->Increment(hit ? HF_CTR_CACHE_HITS : HF_CTR_CACHE_MISSES);
+	return hit;
+}
+
+vector<hf_t> hft::HFTrie::RangeSearchAuto(const uint64_t target, const int radius, HFThreadPool *pool)const{
+	if (!m_flat_enabled || (radius == 0 && m_exact_enabled)) return RangeSearch(target, radius);
+
+	const int n_workers = (pool != NULL) ? pool->Size() : 1;
+	const double scan_cost = COST_SCAN*(double)m_flat_codes.size()/(double)n_workers;
+	if (EstimateSearchCost(radius) <= scan_cost) return RangeSearch(target, radius);
+
+	// searches through the trie are timed by RangeSearch itself
+	hf_op_timer_t timer(m_metrics, HF_OP_RANGESEARCHFLAT);
+	vector<hf_t> results;
+	uint64_t stamp = 0;
+	if (m_cache != NULL && FromCache(target, m_perm.Apply(target), radius, HF_CACHE_EXACT, results, stamp)){
+		if (m_metrics != NULL) m_metrics->RecordResults(results.size());
+		return results;
+	}
+
+	FlatScan(target, radius, pool, results);
+	if (m_cache != NULL) m_cache->Put(target, radius, HF_CACHE_EXACT, results, 0, stamp);
+	if (m_metrics != NULL){
+		m_metrics->Increment(HF_CTR_FLAT_SCANS);
+		m_metrics->RecordResults(results.size());
 	}
 	return results;
 }
 
+bool hft::HFTrie::Empty()const{
+	return m_top == NULL || (m_top->IsLeaf() && m_top->Size() == 0);
+}
+
 size_t hft::HFTrie::Size()const{
 
 	queue<HFNode*> nodes;
@@ -185,6 +1335,17 @@ void hft::HFTrie::Clear(){
 		nodes.pop();
 	}
 	m_top = NULL;
+	m_compact_cursor = 0;
+	m_compact_level = 0;
+	if (m_metrics != NULL) m_metrics->ResetNodes();
+	for (int l=0;l <= NDIMS/CHUNKSIZE;l++){
+		m_internal_nodes[l] = 0;
+	}
+	m_flat_codes.clear();
+	m_flat_ids.clear();
+	m_exact.Clear();
+	if (m_cache != NULL) m_cache->InvalidateAll();
+	BuildRootTable();
 }
 
 size_t hft::HFTrie::MemoryUsage()const{
@@ -199,6 +1360,11 @@ size_t hft::HFTrie::MemoryUsage()const{
 			((HFInternal*)current)->GetChildNodes(nodes);
 		nodes.pop();
 	}
+	nbytes += m_flat_codes.capacity()*sizeof(uint64_t) + m_flat_ids.capacity()*sizeof(hf_id_t);
+	nbytes += m_exact.MemoryUsage();
+	if (m_cache != NULL) nbytes += m_cache->MemoryUsage();
+	if (m_store != NULL) nbytes += m_store->MemoryUsage();
+	nbytes += m_root_table.capacity()*sizeof(hf_root_slot_t);
 	return nbytes + sizeof(HFTrie);
 }
 
@@ -218,11 +1384,12 @@ void hft::HFTrie::Print(ostream &ostrm)const{
 			if (node->IsLeaf()){
 				ostrm << "  leaf(level=" << level << ") size = " << node->Size() << endl;
 
-				vector<hf_t> entries = ((HFLeaf*)node)->GetEntries();
+				vector<hf_t> entries;
+				((HFLeaf*)node)->GetEntries(entries, level);
 
 				ostrm << "ListEntries: " << endl;
 				for (hf_t &e : entries){
-					ostrm << "    " << dec << e.id << " " << hex << e.code << endl;
+					ostrm << "    " << dec << e.id << " " << hex << m_perm.Invert(e.code) << endl;
 				}
 				
 			} else {
@@ -237,3 +1404,180 @@ void hft::HFTrie::Print(ostream &ostrm)const{
 
 	ostrm << endl << endl << "--------END---------" << endl;
 }
+
+hf_stats_t hft::HFTrie::Stats(const double sample)const{
+	if (!(sample > 0.0 && sample <= 1.0)) throw invalid_argument("sample must be in (0, 1]");
+
+	struct stats_node_t {
+		HFNode *node;
+		int lvl;
+		double weight;
+	};
+
+	const int n_levels = NDIMS/CHUNKSIZE + 1;
+	vector<double> internal(n_levels, 0), leaves(n_levels, 0), entries(n_levels, 0);
+	vector<double> occupancy(LC+2, 0), fanout(NODE_FANOUT+1, 0);
+	double internal_bytes = 0, leaf_bytes = 0;
+
+	// sampled subtrees are scaled by the fraction actually kept.  Being breadth
+	// first, every candidate is decided before the first sampled node is visited.
+	minstd_rand rng(1);
+	bernoulli_distribution keep(sample);
+	size_t n_candidates = 0, n_kept = 0;
+
+	queue<stats_node_t> nodes;
+	if (m_top != NULL) nodes.push({ m_top, 0, 1.0 });
+	while (!nodes.empty()){
+		stats_node_t current = nodes.front();
+		nodes.pop();
+		const double w = (current.weight < 0) ? (double)n_candidates/(double)n_kept : current.weight;
+		if (current.node->IsLeaf()){
+			size_t n = current.node->Size();
+			leaves[current.lvl] += w;
+			entries[current.lvl] += w*(double)n;
+			occupancy[min(n, (size_t)LC+1)] += w;
+			leaf_bytes += w*(double)current.node->nbytes();
+			continue;
+		}
+
+		HFInternal *node = (HFInternal*)current.node;
+		internal[current.lvl] += w;
+		fanout[node->NumChildNodes()] += w;
+		internal_bytes += w*(double)node->nbytes();
+
+		queue<HFNode*> children;
+		node->GetChildNodes(children);
+		for (;!children.empty();children.pop()){
+			double weight = w;
+			if (current.lvl+1 == HF_STATS_SAMPLE_LEVEL && sample < 1.0){
+				n_candidates++;
+				if (n_kept > 0 && !keep(rng)) continue;
+				n_kept++;
+				weight = -1;
+			}
+			nodes.push({ children.front(), current.lvl+1, weight });
+		}
+	}
+
+	hf_stats_t stats;
+	stats.sample = sample;
+	for (int l=0;l < n_levels;l++){
+		stats.internal_per_level[l] = llround(internal[l]);
+		stats.leaves_per_level[l] = llround(leaves[l]);
+		stats.entries_per_level[l] = llround(entries[l]);
+		stats.n_internal += stats.internal_per_level[l];
+		stats.n_leaves += stats.leaves_per_level[l];
+		stats.n_entries += stats.entries_per_level[l];
+	}
+	for (int i=0;i <= LC+1;i++){
+		stats.leaf_occupancy[i] = llround(occupancy[i]);
+	}
+	for (int i=0;i <= NODE_FANOUT;i++){
+		stats.fanout[i] = llround(fanout[i]);
+	}
+	stats.internal_bytes = llround(internal_bytes);
+	stats.leaf_bytes = llround(leaf_bytes);
+	return stats;
+}
+
+void hft::HFTrie::EnableMetrics(const bool enable){
+	if (enable && m_metrics == NULL){
+		m_metrics = new HFMetrics();
+		CountNodes();
+	} else if (!enable && m_metrics != NULL){
+		delete m_metrics;
+		m_metrics = NULL;
+	}
+}
+
+void hft::HFTrie::EnableCache(const size_t capacity){
+	delete m_cache;
+	m_cache = (capacity > 0) ? new HFResultCache(capacity) : NULL;
+}
+
+const HFResultCache* hft::HFTrie::GetCache()const{
+	return m_cache;
+}
+
+const HFMetrics* hft::HFTrie::GetMetrics()const{
+	return m_metrics;
+}
+
+void hft::HFTrie::CountNodes(){
+	queue<hf_search_t> nodes;
+	if (m_top != NULL) nodes.push({ m_top, 0, 0 });
+
+	while (!nodes.empty()){
+		hf_search_t current = nodes.front();
+		if (current.node->IsLeaf()){
+			m_metrics->AddNodes(current.lvl, 0, 1);
+		} else {
+			m_metrics->AddNodes(current.lvl, 1, 0);
+			queue<HFNode*> children;
+			((HFInternal*)current.node)->GetChildNodes(children);
+			while (!children.empty()){
+				nodes.push({ children.front(), current.lvl+1, 0 });
+				children.pop();
+			}
+		}
+		nodes.pop();
+	}
+}
+
+#define HFT_MAGIC 0x48465452U
+#define HFT_VERSION 2U
+#define HFT_FLAG_PACKED 0x01U
+#define HFT_LOAD_BATCH 65536
+
+void hft::HFTrie::Save(ostream &ostrm)const{
+	vector<hf_t> entries;
+	CollectEntries(entries);
+	ToCodeSpace(entries);
+
+	uint32_t header[5] = { HFT_MAGIC, HFT_VERSION, NDIMS, CHUNKSIZE, m_packed ? HFT_FLAG_PACKED : 0 };
+	ostrm.write((const char*)header, sizeof(header));
+	m_perm.Write(ostrm);
+
+	uint64_t count = entries.size();
+	ostrm.write((const char*)&count, sizeof(count));
+	// ids are always written as 64 bits, whatever the id type
+	for (const hf_t &e : entries){
+		long long id = e.id;
+		ostrm.write((const char*)&id, sizeof(id));
+		ostrm.write((const char*)&e.code, sizeof(e.code));
+	}
+	if (!ostrm) throw runtime_error("unable to write index");
+}
+
+void hft::HFTrie::Load(istream &istrm){
+	uint32_t header[5] = { 0 };
+	if (!istrm.read((char*)header, 4*sizeof(uint32_t)) || header[0] != HFT_MAGIC)
+		throw runtime_error("not an hftrie index");
+	if (header[1] < 1 || header[1] > HFT_VERSION || header[2] != NDIMS)
+		throw runtime_error("incompatible hftrie index");
+	// version 1 has no flags and keeps the current leaf form
+	if (header[1] >= 2 && !istrm.read((char*)&header[4], sizeof(uint32_t)))
+		throw runtime_error("truncated hftrie index");
+
+	HFPermutation perm;
+	perm.Read(istrm);
+
+	uint64_t count;
+	if (!istrm.read((char*)&count, sizeof(count)))
+		throw runtime_error("truncated hftrie index");
+
+	// grow with the entries actually read, not with a count that may be corrupt
+	vector<hf_t> entries;
+	entries.reserve(min<uint64_t>(count, HFT_LOAD_BATCH));
+	for (uint64_t i=0;i < count;i++){
+		long long id;
+		uint64_t code;
+		if (!istrm.read((char*)&id, sizeof(id)) || !istrm.read((char*)&code, sizeof(code)))
+			throw runtime_error("truncated hftrie index");
+		entries.push_back({ (hf_id_t)id, code });
+	}
+
+	m_perm = perm;
+	if (header[1] >= 2) m_packed = (header[4] & HFT_FLAG_PACKED) != 0;
+	Build(entries, false);
+}
@@ -0,0 +1,174 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <stdexcept>
+#include "hft/hfwindow.hpp"
+
+using namespace std;
+using namespace hft;
+
+hft::HFWindowIndex::HFWindowIndex(const int n_generations){
+	if (n_generations < 1 || n_generations > HF_MAX_GENERATIONS)
+		throw invalid_argument("bad number of generations");
+
+	m_packed = false;
+	m_ring.assign(n_generations, NULL);
+	for (int i=0;i < n_generations;i++){
+		m_ring[i] = NewGeneration();
+	}
+	m_head = 0;
+	m_generation = 0;
+}
+
+hft::HFWindowIndex::~HFWindowIndex(){
+	Reclaim();
+	for (HFTrie *trie : m_ring){
+		delete trie;
+	}
+}
+
+HFTrie* hft::HFWindowIndex::NewGeneration()const{
+	HFTrie *trie = new HFTrie();
+	if (m_packed) trie->EnableCompression(true);
+	return trie;
+}
+
+void hft::HFWindowIndex::Insert(const hf_t &item){
+	m_ring[m_head]->Insert(item);
+}
+
+void hft::HFWindowIndex::BulkLoad(const vector<hf_t> &entries){
+	m_ring[m_head]->BulkLoad(entries);
+}
+
+void hft::HFWindowIndex::Delete(const hf_t &item){
+	for (HFTrie *trie : m_ring){
+		if (!trie->Empty()) trie->Delete(item);
+	}
+}
+
+uint64_t hft::HFWindowIndex::Advance(){
+	m_head = (m_head + 1) % (int)m_ring.size();
+	if (!m_ring[m_head]->Empty()){
+		// allocate first, so that a failure leaves the window unchanged
+		HFTrie *fresh = NewGeneration();
+		m_retired.push_back(m_ring[m_head]);
+		m_ring[m_head] = fresh;
+	}
+	return ++m_generation;
+}
+
+size_t hft::HFWindowIndex::Reclaim(){
+	size_t n = 0;
+	for (HFTrie *trie : m_retired){
+		n += trie->Size();
+		delete trie;
+	}
+	m_retired.clear();
+	return n;
+}
+
+uint64_t hft::HFWindowIndex::Generation()const{
+	return m_generation;
+}
+
+int hft::HFWindowIndex::NumGenerations()const{
+	return (int)m_ring.size();
+}
+
+const HFTrie& hft::HFWindowIndex::GetGeneration(const int age)const{
+	const int n = (int)m_ring.size();
+	if (age < 0 || age >= n) throw out_of_range("no such generation");
+	return *m_ring[(m_head - age + n) % n];
+}
+
+void hft::HFWindowIndex::EnableCompression(const bool enable){
+	m_packed = enable;
+	for (HFTrie *trie : m_ring){
+		trie->EnableCompression(enable);
+	}
+}
+
+vector<hf_t> hft::HFWindowIndex::RangeSearchFast(const uint64_t target, const int radius)const{
+	vector<hf_t> results;
+	vector<int> distances;
+	RangeSearchFast(target, radius, results, distances);
+	return results;
+}
+
+vector<hf_t> hft::HFWindowIndex::RangeSearch(const uint64_t target, const int radius)const{
+	vector<hf_t> results;
+	vector<int> distances;
+	RangeSearch(target, radius, results, distances);
+	return results;
+}
+
+void hft::HFWindowIndex::RangeSearchFast(const uint64_t target, const int radius, vector<hf_t> &results,
+										 vector<int> &distances, const bool sorted)const{
+	const size_t start = results.size();
+	for (const HFTrie *trie : m_ring){
+		if (!trie->Empty()) trie->RangeSearchFast(target, radius, results, distances);
+	}
+	distances.resize(results.size());
+	if (sorted) sort_by_distance(results, distances, start);
+}
+
+void hft::HFWindowIndex::RangeSearch(const uint64_t target, const int radius, vector<hf_t> &results,
+									 vector<int> &distances, const bool sorted)const{
+	const size_t start = results.size();
+	for (const HFTrie *trie : m_ring){
+		if (!trie->Empty()) trie->RangeSearch(target, radius, results, distances);
+	}
+	distances.resize(results.size());
+	if (sorted) sort_by_distance(results, distances, start);
+}
+
+vector<hf_t> hft::HFWindowIndex::KNearestSearch(const uint64_t target, const size_t k)const{
+	return knearest_search(k, [this, target](const int radius, vector<hf_t> &results, vector<int> &distances){
+		RangeSearch(target, radius, results, distances, true);
+	});
+}
+
+size_t hft::HFWindowIndex::Size()const{
+	size_t n = 0;
+	for (const HFTrie *trie : m_ring){
+		n += trie->Size();
+	}
+	return n;
+}
+
+void hft::HFWindowIndex::Clear(){
+	Reclaim();
+	for (HFTrie *trie : m_ring){
+		trie->Clear();
+	}
+	m_head = 0;
+	m_generation = 0;
+}
+
+size_t hft::HFWindowIndex::MemoryUsage()const{
+	size_t n = sizeof(HFWindowIndex) + sizeof(HFTrie*)*(m_ring.capacity() + m_retired.capacity());
+	for (const HFTrie *trie : m_ring){
+		n += trie->MemoryUsage();
+	}
+	for (const HFTrie *trie : m_retired){
+		n += trie->MemoryUsage();
+	}
+	return n;
+}
@@ -0,0 +1,143 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <unistd.h>
+#include "hft/hftrie.hpp"
+#include "hft/hfserver.hpp"
+#include "hft/hfclient.hpp"
+#include "hft/hfmetrics.hpp"
+
+using namespace std;
+using namespace hft;
+
+static uniform_int_distribution<uint64_t> m_distrib(0);
+
+struct options_t {
+	string path;
+	int n_entries = 1000000;
+	int n_conns = 4;
+	int depth = 32;
+	int n_requests = 20000;
+	int radius = 4;
+	int type = HF_MSG_RANGEFAST;
+};
+
+/* issue n_requests with up to depth requests in flight on one connection */
+void run_client(const options_t &opts, const int index, HFHistogram &latency){
+	mt19937_64 gen(index + 1);
+	HFClient client;
+	client.ConnectUnix(opts.path);
+
+	deque<chrono::steady_clock::time_point> in_flight;
+	int sent = 0, received = 0;
+	while (received < opts.n_requests){
+		while (sent < opts.n_requests && (int)in_flight.size() < opts.depth){
+			client.Send({ (uint8_t)opts.type, 0, m_distrib(gen), opts.radius });
+			in_flight.push_back(chrono::steady_clock::now());
+			sent++;
+		}
+		client.Flush();
+
+		hf_response_t resp;
+		client.Receive(resp);
+		auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - in_flight.front());
+		latency.Record(nsecs.count());
+		in_flight.pop_front();
+		received++;
+	}
+}
+
+int main(int argc, char **argv){
+
+	options_t opts;
+	int c;
+	while ((c = getopt(argc, argv, "s:n:c:d:q:r:m:h")) != -1){
+		switch (c){
+		case 's': opts.path = optarg; break;
+		case 'n': opts.n_entries = atoi(optarg); break;
+		case 'c': opts.n_conns = atoi(optarg); break;
+		case 'd': opts.depth = atoi(optarg); break;
+		case 'q': opts.n_requests = atoi(optarg); break;
+		case 'r': opts.radius = atoi(optarg); break;
+		case 'm': opts.type = (string(optarg) == "exact") ? HF_MSG_RANGE : HF_MSG_RANGEFAST; break;
+		default:
+			cout << "usage: " << argv[0] << " [-s socket] [-n entries] [-c connections] [-d pipeline depth]"
+				 << " [-q requests per connection] [-r radius] [-m fast|exact]" << endl;
+			cout << "  without -s, an in-process server over n random entries is started" << endl;
+			return (c == 'h') ? 0 : 1;
+		}
+	}
+
+	HFTrie trie;
+	HFServer *server = NULL;
+	thread loop;
+	if (opts.path.empty()){
+		mt19937_64 gen(0);
+		vector<hf_t> entries;
+		for (int i=0;i < opts.n_entries;i++){
+			entries.push_back({ (hf_id_t)(i+1), m_distrib(gen) });
+		}
+		trie.BulkLoad(entries);
+
+		opts.path = "/tmp/hftrie_bench_" + to_string(getpid()) + ".sock";
+		server = new HFServer(trie);
+		server->ListenUnix(opts.path);
+		loop = thread([server]{ server->Run(); });
+		cout << "in-process server with " << opts.n_entries << " entries" << endl;
+	}
+
+	HFHistogram latency;
+	vector<thread> clients;
+	auto s = chrono::steady_clock::now();
+	for (int i=0;i < opts.n_conns;i++){
+		clients.emplace_back(run_client, cref(opts), i, ref(latency));
+	}
+	for (thread &t : clients){
+		t.join();
+	}
+	auto e = chrono::steady_clock::now();
+
+	if (server != NULL){
+		server->Stop();
+		loop.join();
+		delete server;
+	}
+
+	hf_histogram_snapshot_t snapshot;
+	snapshot.Merge(latency);
+	double secs = chrono::duration<double>(e - s).count();
+
+	cout << opts.n_conns << " connections, depth " << opts.depth << ", radius " << opts.radius
+		 << (opts.type == HF_MSG_RANGE ? " exact" : " fast") << endl;
+	cout << "throughput: " << fixed << setprecision(0) << (double)snapshot.count/secs << " queries/sec" << endl;
+	cout << "latency (usecs): mean " << setprecision(1) << snapshot.Mean()/1000.0
+		 << " p50 " << snapshot.Percentile(0.5)/1000.0
+		 << " p99 " << snapshot.Percentile(0.99)/1000.0
+		 << " p999 " << snapshot.Percentile(0.999)/1000.0
+		 << " max " << snapshot.max/1000.0 << endl;
+
+	return 0;
+}
@@ -0,0 +1,353 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <shared_mutex>
+#include <algorithm>
+#include <unistd.h>
+#include "hft/hftrie.hpp"
+#include "hft/hfmetrics.hpp"
+
+using namespace std;
+using namespace hft;
+
+enum wl_op_t { WL_READ = 0, WL_INSERT, WL_DELETE, WL_OP_COUNT };
+
+enum wl_keys_t { WL_UNIFORM = 0, WL_ZIPF, WL_CLUSTER };
+
+static const char *wl_op_names[WL_OP_COUNT] = { "read", "insert", "delete" };
+
+struct options_t {
+	int n_threads = 4;
+	int seconds = 10;
+	int interval_ms = 1000;
+	int n_entries = 1000000;
+	int mix[WL_OP_COUNT] = { 90, 5, 5 };
+	int keys = WL_UNIFORM;
+	int n_centers = 1024;
+	double theta = 0.99;
+	int radius = 4;
+	bool fast = true;
+	bool splits = false;
+};
+
+/* shared by all worker threads; the trie is not internally synchronized, so
+   reads hold the lock shared and inserts/deletes hold it exclusively */
+struct workload_t {
+	const options_t *opts;
+	HFTrie trie;
+	shared_mutex lock;
+	vector<uint64_t> centers;
+	vector<double> zipf_cdf;
+	atomic<long long> next_id;
+	atomic<long long> live;
+	atomic<bool> stop;
+	chrono::steady_clock::time_point start;
+	vector<HFHistogram> latency;  /* one per op type for each interval */
+
+	workload_t(const options_t &o, const int n_intervals):opts(&o),next_id(0),live(0),stop(false),
+														  latency(n_intervals*WL_OP_COUNT){}
+};
+
+/* flip up to maxbits random bits of code */
+static uint64_t perturb(mt19937_64 &gen, const uint64_t code, const int maxbits){
+	if (maxbits <= 0) return code;
+	uniform_int_distribution<int> n_bits(0, maxbits), bitindex(0, 63);
+	uint64_t val = code;
+	int n = n_bits(gen);
+	for (int i=0;i < n;i++){
+		val ^= (0x01ULL << bitindex(gen));
+	}
+	return val;
+}
+
+/* zipfian rank in [0, n) from the precomputed cumulative distribution */
+static size_t zipf_rank(mt19937_64 &gen, const vector<double> &cdf){
+	uniform_real_distribution<double> u(0.0, 1.0);
+	size_t rank = lower_bound(cdf.begin(), cdf.end(), u(gen)) - cdf.begin();
+	return (rank < cdf.size()) ? rank : cdf.size() - 1;
+}
+
+/* read target or inserted code for the configured key distribution:
+   zipf reads hit the hot targets exactly and inserts land around them;
+   cluster reads and inserts fall within radius of a uniformly chosen center */
+static uint64_t next_code(mt19937_64 &gen, const workload_t &wl, const wl_op_t op){
+	switch (wl.opts->keys){
+	case WL_ZIPF: {
+		uint64_t center = wl.centers[zipf_rank(gen, wl.zipf_cdf)];
+		return (op == WL_READ) ? center : perturb(gen, center, wl.opts->radius);
+	}
+	case WL_CLUSTER: {
+		uniform_int_distribution<size_t> pick(0, wl.centers.size() - 1);
+		return perturb(gen, wl.centers[pick(gen)], wl.opts->radius);
+	}
+	default:
+		return gen();
+	}
+}
+
+static void generate(mt19937_64 &gen, workload_t &wl, vector<hf_t> &entries){
+	const options_t &opts = *wl.opts;
+	if (opts.keys == WL_CLUSTER){
+		for (int i=0;i < opts.n_centers;i++){
+			wl.centers.push_back(gen());
+		}
+	}
+
+	for (int i=0;i < opts.n_entries;i++){
+		uint64_t code = gen();
+		if (opts.keys == WL_CLUSTER) code = perturb(gen, wl.centers[i % opts.n_centers], opts.radius);
+		entries.push_back({ (hf_id_t)(++wl.next_id), code });
+	}
+
+	if (opts.keys == WL_ZIPF){
+		uniform_int_distribution<size_t> pick(0, entries.size() - 1);
+		for (int i=0;i < opts.n_centers;i++){
+			wl.centers.push_back(entries.empty() ? gen() : entries[pick(gen)].code);
+		}
+		double total = 0;
+		for (int i=0;i < opts.n_centers;i++){
+			total += 1.0/pow((double)(i+1), opts.theta);
+			wl.zipf_cdf.push_back(total);
+		}
+		for (double &p : wl.zipf_cdf){
+			p /= total;
+		}
+	}
+	wl.live = entries.size();
+}
+
+/* each worker deletes only entries it owns (its share of the initial entries plus
+   its own inserts), so a delete always names an entry that is in the trie */
+static void run_worker(workload_t &wl, const int index, vector<hf_t> owned){
+	const options_t &opts = *wl.opts;
+	mt19937_64 gen(index + 1);
+	uniform_int_distribution<int> percent(0, 99);
+	const long long interval_ns = (long long)opts.interval_ms*1000000LL;
+	const int n_intervals = wl.latency.size()/WL_OP_COUNT;
+
+	vector<hf_t> results;
+	while (!wl.stop.load(memory_order_relaxed)){
+		int p = percent(gen);
+		wl_op_t op = (p < opts.mix[WL_READ]) ? WL_READ : (p < opts.mix[WL_READ] + opts.mix[WL_INSERT]) ? WL_INSERT : WL_DELETE;
+		if (op == WL_DELETE && owned.empty()) op = WL_INSERT;
+
+		auto s = chrono::steady_clock::now();
+		if (op == WL_READ){
+			uint64_t target = next_code(gen, wl, op);
+			shared_lock<shared_mutex> lock(wl.lock);
+			results = opts.fast ? wl.trie.RangeSearchFast(target, opts.radius) : wl.trie.RangeSearch(target, opts.radius);
+		} else if (op == WL_INSERT){
+			hf_t item = { (hf_id_t)(++wl.next_id), next_code(gen, wl, op) };
+			{
+				unique_lock<shared_mutex> lock(wl.lock);
+				wl.trie.Insert(item);
+			}
+			owned.push_back(item);
+			wl.live++;
+		} else {
+			uniform_int_distribution<size_t> pick(0, owned.size() - 1);
+			size_t i = pick(gen);
+			{
+				unique_lock<shared_mutex> lock(wl.lock);
+				wl.trie.Delete(owned[i]);
+			}
+			owned[i] = owned.back();
+			owned.pop_back();
+			wl.live--;
+		}
+		auto e = chrono::steady_clock::now();
+
+		/* ops are counted in the interval they complete in */
+		int k = (int)(chrono::duration_cast<chrono::nanoseconds>(e - wl.start).count()/interval_ns);
+		if (k >= n_intervals) k = n_intervals - 1;
+		wl.latency[k*WL_OP_COUNT + op].Record(chrono::duration_cast<chrono::nanoseconds>(e - s).count());
+	}
+}
+
+static void print_header(const options_t &opts){
+	cout << setw(8) << "time(s)" << setw(12) << "ops/s";
+	for (int op=0;op < WL_OP_COUNT;op++){
+		cout << setw(10) << (string(wl_op_names[op]) + "/s");
+	}
+	cout << setw(10) << "rd p50" << setw(10) << "rd p99" << setw(10) << "rd p999"
+		 << setw(10) << "wr p99" << setw(10) << "wr p999" << setw(12) << "entries";
+	if (opts.splits) cout << setw(10) << "splits";
+	cout << endl;
+}
+
+static void print_interval(workload_t &wl, const int k, const double secs, const uint64_t splits){
+	hf_histogram_snapshot_t ops[WL_OP_COUNT], writes;
+	uint64_t total = 0;
+	for (int op=0;op < WL_OP_COUNT;op++){
+		ops[op].Merge(wl.latency[k*WL_OP_COUNT + op]);
+		total += ops[op].count;
+	}
+	writes.Merge(wl.latency[k*WL_OP_COUNT + WL_INSERT]);
+	writes.Merge(wl.latency[k*WL_OP_COUNT + WL_DELETE]);
+
+	cout << fixed << setprecision(1) << setw(8) << (double)(k+1)*wl.opts->interval_ms/1000.0
+		 << setprecision(0) << setw(12) << (double)total/secs;
+	for (int op=0;op < WL_OP_COUNT;op++){
+		cout << setw(10) << (double)ops[op].count/secs;
+	}
+	cout << setprecision(1) << setw(10) << ops[WL_READ].Percentile(0.5)/1000.0
+		 << setw(10) << ops[WL_READ].Percentile(0.99)/1000.0
+		 << setw(10) << ops[WL_READ].Percentile(0.999)/1000.0
+		 << setw(10) << writes.Percentile(0.99)/1000.0
+		 << setw(10) << writes.Percentile(0.999)/1000.0
+		 << setw(12) << wl.live.load();
+	if (wl.opts->splits) cout << setw(10) << splits;
+	cout << endl;
+}
+
+static void print_summary(workload_t &wl, const double secs){
+	const int n_intervals = wl.latency.size()/WL_OP_COUNT;
+	cout << endl << "latency (usecs) over " << setprecision(1) << secs << " secs:" << endl;
+	for (int op=0;op < WL_OP_COUNT;op++){
+		hf_histogram_snapshot_t snapshot;
+		for (int k=0;k < n_intervals;k++){
+			snapshot.Merge(wl.latency[k*WL_OP_COUNT + op]);
+		}
+		cout << setw(8) << wl_op_names[op] << ": " << snapshot.count << " ops, "
+			 << setprecision(0) << (double)snapshot.count/secs << " ops/sec, mean "
+			 << setprecision(1) << snapshot.Mean()/1000.0
+			 << " p50 " << snapshot.Percentile(0.5)/1000.0
+			 << " p99 " << snapshot.Percentile(0.99)/1000.0
+			 << " p999 " << snapshot.Percentile(0.999)/1000.0
+			 << " max " << snapshot.max/1000.0 << endl;
+	}
+}
+
+static bool parse_mix(const string &arg, int mix[WL_OP_COUNT]){
+	int n = sscanf(arg.c_str(), "%d:%d:%d", &mix[WL_READ], &mix[WL_INSERT], &mix[WL_DELETE]);
+	if (n != WL_OP_COUNT) return false;
+	for (int op=0;op < WL_OP_COUNT;op++){
+		if (mix[op] < 0) return false;
+	}
+	return mix[WL_READ] + mix[WL_INSERT] + mix[WL_DELETE] == 100;
+}
+
+static int usage(const char *prog, const int code){
+	cout << "usage: " << prog << " [-t threads] [-T seconds] [-i interval msecs] [-n entries]"
+		 << " [-x read:insert:delete] [-k uniform|zipf|cluster] [-c centers] [-z theta]"
+		 << " [-r radius] [-m fast|exact] [-l]" << endl;
+	cout << "  -x  percentages of each operation, summing to 100 (default 90:5:5)" << endl;
+	cout << "  -k  zipf draws reads from c hot targets with skew theta and inserts around them;" << endl;
+	cout << "      cluster places entries, reads and inserts within radius of c centers" << endl;
+	cout << "  -l  also report leaf splits per interval (enables trie metrics)" << endl;
+	return code;
+}
+
+int main(int argc, char **argv){
+
+	options_t opts;
+	int c;
+	while ((c = getopt(argc, argv, "t:T:i:n:x:k:c:z:r:m:lh")) != -1){
+		switch (c){
+		case 't': opts.n_threads = atoi(optarg); break;
+		case 'T': opts.seconds = atoi(optarg); break;
+		case 'i': opts.interval_ms = atoi(optarg); break;
+		case 'n': opts.n_entries = atoi(optarg); break;
+		case 'x':
+			if (!parse_mix(optarg, opts.mix)){
+				cerr << "bad mix: " << optarg << " (percentages must sum to 100)" << endl;
+				return 1;
+			}
+			break;
+		case 'k':
+			if (string(optarg) == "uniform") opts.keys = WL_UNIFORM;
+			else if (string(optarg) == "zipf") opts.keys = WL_ZIPF;
+			else if (string(optarg) == "cluster") opts.keys = WL_CLUSTER;
+			else return usage(argv[0], 1);
+			break;
+		case 'c': opts.n_centers = atoi(optarg); break;
+		case 'z': opts.theta = atof(optarg); break;
+		case 'r': opts.radius = atoi(optarg); break;
+		case 'm': opts.fast = (string(optarg) != "exact"); break;
+		case 'l': opts.splits = true; break;
+		default:
+			return usage(argv[0], (c == 'h') ? 0 : 1);
+		}
+	}
+	if (opts.n_threads < 1 || opts.seconds < 1 || opts.interval_ms < 1 || opts.n_entries < 0 || opts.n_centers < 1){
+		return usage(argv[0], 1);
+	}
+
+	const int n_intervals = max(1, (int)((opts.seconds*1000LL + opts.interval_ms - 1)/opts.interval_ms));
+	workload_t wl(opts, n_intervals);
+
+	mt19937_64 gen(0);
+	vector<hf_t> entries;
+	generate(gen, wl, entries);
+	wl.trie.BulkLoad(entries);
+	if (opts.splits) wl.trie.EnableMetrics(true);
+
+	/* deal the initial entries out to the workers as the ones they may delete */
+	vector<vector<hf_t>> owned(opts.n_threads);
+	for (size_t i=0;i < entries.size();i++){
+		owned[i % opts.n_threads].push_back(entries[i]);
+	}
+	entries.clear();
+	entries.shrink_to_fit();
+
+	cout << opts.n_threads << " threads, " << opts.n_entries << " entries, mix "
+		 << opts.mix[WL_READ] << ":" << opts.mix[WL_INSERT] << ":" << opts.mix[WL_DELETE]
+		 << ", " << (opts.keys == WL_ZIPF ? "zipf" : opts.keys == WL_CLUSTER ? "cluster" : "uniform")
+		 << " keys, radius " << opts.radius << (opts.fast ? " fast" : " exact") << endl;
+	print_header(opts);
+
+	wl.start = chrono::steady_clock::now();
+	vector<thread> workers;
+	for (int i=0;i < opts.n_threads;i++){
+		workers.emplace_back(run_worker, ref(wl), i, move(owned[i]));
+	}
+
+	uint64_t splits = 0;
+	for (int k=0;k < n_intervals;k++){
+		auto until = wl.start + chrono::milliseconds((long long)(k+1)*opts.interval_ms);
+		this_thread::sleep_until(until);
+		if (k == n_intervals - 1){
+			wl.stop = true;
+			for (thread &t : workers){
+				t.join();
+			}
+		}
+
+		uint64_t n_splits = 0;
+		if (opts.splits){
+			n_splits = wl.trie.GetMetrics()->Snapshot().counters[HF_CTR_LEAF_SPLITS];
+		}
+		print_interval(wl, k, opts.interval_ms/1000.0, n_splits - splits);
+		splits = n_splits;
+	}
+
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - wl.start).count();
+	print_summary(wl, secs);
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PERF_N_COUNTERS 6
+
+enum perf_counter_t {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES
+};
+
+static const char *perf_counter_names[PERF_N_COUNTERS] = { "cycles", "instructions", "L1d misses",
+														   "LLC misses", "dTLB misses", "branch misses" };
+
+static inline uint64_t perf_cache_config(const uint64_t cache){
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+/* counts of one phase, negative for counters that are not available */
+struct perf_sample_t {
+	double counts[PERF_N_COUNTERS];
+
+	/* one line of counts per op */
+	void Print(std::ostream &ostrm, const char *phase, const double n_ops)const{
+		std::ios_base::fmtflags flags = ostrm.flags();
+		std::streamsize precision = ostrm.precision();
+		ostrm << "    " << std::left << std::setw(14) << phase << std::right << std::fixed << std::setprecision(1);
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			ostrm << std::setw(15);
+			if (counts[i] < 0) ostrm << "n/a";
+			else ostrm << counts[i]/n_ops;
+		}
+		if (counts[PERF_CYCLES] > 0 && counts[PERF_INSTRUCTIONS] >= 0)
+			ostrm << std::setw(8) << std::setprecision(2) << counts[PERF_INSTRUCTIONS]/counts[PERF_CYCLES];
+		ostrm << std::endl;
+		ostrm.flags(flags);
+		ostrm.precision(precision);
+	}
+
+	static void PrintHeader(std::ostream &ostrm){
+		ostrm << "    " << std::left << std::setw(14) << "per op" << std::right;
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			ostrm << std::setw(15) << perf_counter_names[i];
+		}
+		ostrm << std::setw(8) << "IPC" << std::endl;
+	}
+};
+
+/**
+ * Hardware counters of the calling thread, user space only, read with
+ * perf_event_open around each phase of a benchmark.  Each counter is opened on
+ * its own so that those the machine lacks (no PMU in a VM, say, or a strict
+ * perf_event_paranoid) just read as unavailable.  Counts are scaled up for the
+ * time a counter was not scheduled when the kernel multiplexes them.
+ **/
+struct perf_counters_t {
+	int fds[PERF_N_COUNTERS];
+
+	perf_counters_t(){
+		const uint32_t types[PERF_N_COUNTERS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+												  PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+		const uint64_t configs[PERF_N_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+													perf_cache_config(PERF_COUNT_HW_CACHE_L1D),
+													perf_cache_config(PERF_COUNT_HW_CACHE_LL),
+													perf_cache_config(PERF_COUNT_HW_CACHE_DTLB),
+													PERF_COUNT_HW_BRANCH_MISSES };
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[i];
+			attr.config = configs[i];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+	}
+
+	~perf_counters_t(){
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			if (fds[i] >= 0) close(fds[i]);
+		}
+	}
+
+	perf_counters_t(const perf_counters_t &other) = delete;
+	perf_counters_t& operator=(const perf_counters_t &other) = delete;
+
+	/* whether any counter could be opened */
+	bool Available()const{
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			if (fds[i] >= 0) return true;
+		}
+		return false;
+	}
+
+	void Start(){
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			if (fds[i] < 0) continue;
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	perf_sample_t Stop(){
+		perf_sample_t sample;
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			if (fds[i] >= 0) ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+		for (int i=0;i < PERF_N_COUNTERS;i++){
+			uint64_t values[3];
+			sample.counts[i] = -1;
+			if (fds[i] < 0 || read(fds[i], values, sizeof(values)) != sizeof(values)) continue;
+			if (values[2] > 0) sample.counts[i] = (double)values[0]*(double)values[1]/(double)values[2];
+			else sample.counts[i] = 0;
+		}
+		return sample;
+	}
+};
+
+#endif /* _PERF_COUNTERS_H */
@@ -26,7 +26,9 @@
 #include <chrono>
 #include <cassert>
 #include <ratio>
+#include <unistd.h>
 #include "hft/hftrie.hpp"
+#include "perf_counters.hpp"
 
 using namespace std;
 using namespace hft;
@@ -39,8 +41,11 @@ static uniform_int_distribution<uint64_t> m_distrib(0);
 static uniform_int_distribution<int> bitindex(0, 63);
 
 
-static long long m_id = 1;
-static long long g_id = 100000000;
+static hf_id_t m_id = 1;
+static hf_id_t g_id = 100000000;
+
+/* hardware counters for each phase, with -p */
+static perf_counters_t *m_perf = NULL;
 
 struct perfmetric {
 	double avg_build_ops;
@@ -94,12 +99,15 @@ void do_run(const int index, const int n_runs, const int n_entries,
 	vector<hf_t> entries;
 	generate_data(entries, n_entries);
 
+	perf_sample_t insert_counts, fast_counts, exact_counts;
 	hf_t::n_ops = 0;
+	if (m_perf != NULL) m_perf->Start();
 	auto s = chrono::steady_clock::now();
 	for (auto &e : entries){
 		trie.Insert(e);
 	}
 	auto e = chrono::steady_clock::now();
+	if (m_perf != NULL) insert_counts = m_perf->Stop();
 	total += (e - s);
 	sz = trie.Size();
 	assert(sz == n_entries);
@@ -132,6 +140,7 @@ void do_run(const int index, const int n_runs, const int n_entries,
 	
 	hf_t::n_ops = 0;
 	chrono::duration<double, milli> querytime(0);
+	if (m_perf != NULL) m_perf->Start();
 	for (int i=0;i < n_clusters;i++){
 		auto s = chrono::steady_clock::now();
 		vector<hf_t> results = trie.RangeSearchFast(centers[i], radius);
@@ -142,6 +151,16 @@ void do_run(const int index, const int n_runs, const int n_entries,
 		total_returned += nresults;
 		assert((int)nresults >=0);
 	}
+	if (m_perf != NULL){
+		fast_counts = m_perf->Stop();
+
+		// exact search of the same targets, only measured for its counters
+		m_perf->Start();
+		for (int i=0;i < n_clusters;i++){
+			trie.RangeSearch(centers[i], radius);
+		}
+		exact_counts = m_perf->Stop();
+	}
 
 	m.avg_query_ops = 100.0*((double)hf_t::n_ops/(double)n_clusters/(double)sz);
 	m.avg_query_time = (double)querytime.count()/(double)n_clusters;
@@ -149,6 +168,12 @@ void do_run(const int index, const int n_runs, const int n_entries,
 	
 	cout << " query ops " << dec << setprecision(6) << m.avg_query_ops << "% opers   " 
 		 << "query time: " << dec <<setprecision(6) <<  m.avg_query_time << " millisecs" << endl;
+	if (m_perf != NULL){
+		perf_sample_t::PrintHeader(cout);
+		insert_counts.Print(cout, "insert", n_entries);
+		fast_counts.Print(cout, "fast search", n_clusters);
+		exact_counts.Print(cout, "exact search", n_clusters);
+	}
 
 
 	metrics.push_back(m);
@@ -199,6 +224,22 @@ void do_experiment(const int n, const int n_runs, const int n_entries,
 
 int main(int argc, char **argv){
 
+	int c;
+	while ((c = getopt(argc, argv, "ph")) != -1){
+		switch (c){
+		case 'p': m_perf = new perf_counters_t(); break;
+		default:
+			cout << "usage: " << argv[0] << " [-p]" << endl;
+			cout << "  -p  report hardware counters per insert and per query for each run" << endl;
+			return (c == 'h') ? 0 : 1;
+		}
+	}
+	if (m_perf != NULL && !m_perf->Available()){
+		cerr << "hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)" << endl;
+		delete m_perf;
+		m_perf = NULL;
+	}
+
 	const int n_runs = 5;
 	const int n_experiments = 12;
 	const int n_entries[n_experiments] = { 100000, 200000, 400000, 800000,
@@ -230,6 +271,7 @@ int main(int argc, char **argv){
 		do_experiment(i+1, n_runs, N, n_clusters, cluster_size, rad[i]);
 	}
 
+	delete m_perf;
 	return 0;
 }
 
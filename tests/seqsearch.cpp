@@ -6,6 +6,8 @@
 #include <random>
 #include <chrono>
 #include <cassert>
+#include <unistd.h>
+#include "perf_counters.hpp"
 
 using namespace std;
 
@@ -13,6 +15,9 @@ using namespace std;
 static long long m_id = 1;
 static long long g_id = 100000;
 
+/* hardware counters for the scans, with -p */
+static perf_counters_t *m_perf = NULL;
+
 static random_device m_rd;
 static mt19937_64 m_gen(m_rd());
 static uniform_int_distribution<uint64_t> m_distrib(0);
@@ -102,6 +107,7 @@ void run(const int index, const int n_entries, const int n_clusters,
 
 	entry_t::n_ops = 0;
 	chrono::duration<double,milli> querytime(0);
+	if (m_perf != NULL) m_perf->Start();
 	for (int i=0;i < n_clusters;i++){
 
 		auto s = chrono::steady_clock::now();
@@ -111,6 +117,8 @@ void run(const int index, const int n_entries, const int n_clusters,
 		querytime += (e - s);
 		assert((int)results.size() >= cluster_size);
 	}
+	perf_sample_t counts;
+	if (m_perf != NULL) counts = m_perf->Stop();
 
 	size_t sz = entries.size();
 	
@@ -119,6 +127,10 @@ void run(const int index, const int n_entries, const int n_clusters,
 
 	cout << "(" << index << ") query opers: " << dec << setprecision(6) << query_ops << " %opers  "
 		 << "query time: " << dec << setprecision(6) << query_time << " millisecs" << endl;
+	if (m_perf != NULL){
+		perf_sample_t::PrintHeader(cout);
+		counts.Print(cout, "scan", n_clusters);
+	}
 
 	perfmetric m;
 	m.avg_query_ops = query_ops;
@@ -160,6 +172,22 @@ void do_experiment(const int n_runs, const int n_entries, const int n_clusters,
 
 int main(int argc, char **argv){
 
+	int c;
+	while ((c = getopt(argc, argv, "ph")) != -1){
+		switch (c){
+		case 'p': m_perf = new perf_counters_t(); break;
+		default:
+			cout << "usage: " << argv[0] << " [-p]" << endl;
+			cout << "  -p  report hardware counters per query for each run" << endl;
+			return (c == 'h') ? 0 : 1;
+		}
+	}
+	if (m_perf != NULL && !m_perf->Available()){
+		cerr << "hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)" << endl;
+		delete m_perf;
+		m_perf = NULL;
+	}
+
 	const int n_runs = 1;
 	const int n_experiments = 15;
 	const int n_entries[n_experiments] = { 100000, 200000, 400000, 800000,
@@ -176,5 +204,6 @@ int main(int argc, char **argv){
 		do_experiment(n_runs, n_entries[i], n_clusters, cluster_size, radius);
 	}
 
+	delete m_perf;
 	return 0;
 }
@@ -0,0 +1,264 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+#include <unistd.h>
+#include "hft/hftrie.hpp"
+
+using namespace std;
+using namespace hft;
+
+const int n_entries = 5000;
+const int n_queries = 30;
+const int radius = 8;
+
+static random_device m_rd;
+static mt19937_64 m_gen(m_rd());
+static uniform_int_distribution<uint64_t> m_distrib(0);
+static uniform_int_distribution<int> m_bitindex(0, 63);
+
+/* path of the hftrie tool under test, and a prefix for the files it works on */
+static string m_tool;
+static string m_prefix;
+
+typedef map<size_t, vector<long long>> query_results_t;
+
+int run(const string &args){
+	string cmd = m_tool + " " + args + " 2>/dev/null";
+	int status = system(cmd.c_str());
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+string file(const string &name){
+	return m_prefix + name;
+}
+
+void write_text(const string &path, const vector<hf_t> &entries){
+	ofstream ostrm(path);
+	ostrm << "# id code" << endl << endl;
+	for (const hf_t &e : entries){
+		ostrm << (long long)e.id << " " << hex << e.code << dec << endl;
+	}
+}
+
+void write_binary(const string &path, const vector<hf_t> &entries){
+	ofstream ostrm(path, ios::binary);
+	for (const hf_t &e : entries){
+		long long id = e.id;
+		ostrm.write((const char*)&id, sizeof(id));
+		ostrm.write((const char*)&e.code, sizeof(e.code));
+	}
+}
+
+void write_queries(const string &path, const vector<uint64_t> &queries, const bool binary){
+	ofstream ostrm(path, binary ? ios::binary : ios::out);
+	for (uint64_t q : queries){
+		if (binary) ostrm.write((const char*)&q, sizeof(q));
+		else ostrm << "0x" << hex << q << dec << endl;
+	}
+}
+
+/* query output is one "query id code distance" line per result */
+query_results_t read_results(const string &path, const vector<uint64_t> &queries, const vector<hf_t> &entries){
+	map<long long, uint64_t> codes;
+	for (const hf_t &e : entries){
+		codes[e.id] = e.code;
+	}
+
+	query_results_t results;
+	ifstream istrm(path);
+	size_t q;
+	long long id;
+	uint64_t code;
+	int d;
+	while (istrm >> q >> id >> hex >> code >> dec >> d){
+		assert(q < queries.size());
+		assert(codes.count(id) && codes[id] == code);
+		assert(__builtin_popcountll(code ^ queries[q]) == d);
+		results[q].push_back(id);
+	}
+	for (auto &r : results){
+		sort(r.second.begin(), r.second.end());
+	}
+	return results;
+}
+
+query_results_t brute_force(const vector<hf_t> &entries, const vector<uint64_t> &queries){
+	query_results_t results;
+	for (size_t q=0;q < queries.size();q++){
+		for (const hf_t &e : entries){
+			if (__builtin_popcountll(e.code ^ queries[q]) <= radius) results[q].push_back(e.id);
+		}
+		sort(results[q].begin(), results[q].end());
+	}
+	for (auto it=results.begin();it != results.end();){
+		if (it->second.empty()) it = results.erase(it);
+		else it++;
+	}
+	return results;
+}
+
+bool is_subset(const query_results_t &found, const query_results_t &expected){
+	for (auto &r : found){
+		auto it = expected.find(r.first);
+		if (it == expected.end() || !includes(it->second.begin(), it->second.end(), r.second.begin(), r.second.end()))
+			return false;
+	}
+	return true;
+}
+
+string read_file(const string &path){
+	ifstream istrm(path);
+	stringstream ss;
+	ss << istrm.rdbuf();
+	return ss.str();
+}
+
+/* leaf bytes from the stats output */
+size_t leaf_bytes(const string &stats){
+	size_t pos = stats.find("\"leaf\":");
+	return (pos == string::npos) ? 0 : strtoull(stats.c_str() + pos + 7, NULL, 10);
+}
+
+void test_build_query_stats(const vector<hf_t> &entries, const vector<uint64_t> &queries){
+	cout << "Test build, query and stats" << endl;
+	const query_results_t expected = brute_force(entries, queries);
+
+	for (bool binary : { false, true }){
+		const string flag = binary ? "-b " : "";
+		if (binary) write_binary(file("entries.bin"), entries);
+		else write_text(file("entries.txt"), entries);
+		write_queries(file("queries"), queries, binary);
+
+		int status = run("build " + flag + "-t 2 " + file(binary ? "entries.bin " : "entries.txt ") + file("index"));
+		cout << (binary ? "binary" : "text") << " build status " << status << endl;
+		assert(status == 0);
+
+		status = run("query " + flag + "-t 2 -r " + to_string(radius) + " -o " + file("out ") + file("index ") + file("queries"));
+		query_results_t found = read_results(file("out"), queries, entries);
+		cout << "query status " << status << ", " << found.size() << " of " << queries.size() << " queries matched" << endl;
+		assert(status == 0 && found == expected);
+
+		// fast search finds a subset of the exact results
+		status = run("query " + flag + "-m fast -r " + to_string(radius) + " -o " + file("out ") + file("index ") + file("queries"));
+		query_results_t fast = read_results(file("out"), queries, entries);
+		assert(status == 0 && is_subset(fast, expected));
+
+		// planned searches, with flat scans over the pool, are exact
+		status = run("query " + flag + "-t 2 -m auto -r " + to_string(radius) + " -o " + file("out ") + file("index ") + file("queries"));
+		query_results_t planned = read_results(file("out"), queries, entries);
+		assert(status == 0 && planned == expected);
+	}
+
+	int status = system((m_tool + " stats " + file("index") + " > " + file("stats") + " 2>/dev/null").c_str());
+	string stats = read_file(file("stats"));
+	cout << "stats status " << status << ": " << stats.substr(0, 60) << "..." << endl;
+	assert(status == 0 && stats.find("\"entries\":" + to_string(entries.size()) + ",") != string::npos);
+
+	// an index built with -c is loaded with packed leaves
+	status = run("build -c " + file("entries.txt ") + file("index"));
+	status |= system((m_tool + " stats " + file("index") + " > " + file("stats") + " 2>/dev/null").c_str());
+	size_t plain_bytes = leaf_bytes(stats), packed_bytes = leaf_bytes(read_file(file("stats")));
+	cout << "leaf bytes: " << plain_bytes << " plain, " << packed_bytes << " packed" << endl;
+	assert(status == 0 && packed_bytes > 0 && packed_bytes < plain_bytes);
+}
+
+void test_bad_ids(){
+	cout << "Test id range" << endl;
+	typedef numeric_limits<hf_id_t> limits;
+
+	// the extremes of the id type are kept exactly
+	vector<hf_t> entries = { { limits::max(), m_distrib(m_gen) }, { limits::min(), m_distrib(m_gen) } };
+	write_text(file("entries.txt"), entries);
+	write_queries(file("queries"), { entries[0].code, entries[1].code }, false);
+	int status = run("build " + file("entries.txt ") + file("index"));
+	status |= run("query -r 0 -o " + file("out ") + file("index ") + file("queries"));
+	query_results_t found = read_results(file("out"), { entries[0].code, entries[1].code }, entries);
+	cout << "extreme ids status " << status << endl;
+	assert(status == 0 && found.size() == 2);
+	assert(found[0] == vector<long long>{ (long long)limits::max() });
+	assert(found[1] == vector<long long>{ (long long)limits::min() });
+
+	// one past either end, or far past, is an error
+	vector<string> bad = { "99999999999999999999", "-99999999999999999999" };
+	unsigned long long over = (unsigned long long)limits::max() + 1;
+	if (over != 0) bad.push_back(to_string(over));
+	if (limits::is_signed) bad.push_back("-" + to_string(over + 1));
+	else bad.push_back("-1");
+	for (const string &id : bad){
+		ofstream(file("bad.txt")) << id << " ff" << endl;
+		status = run("build " + file("bad.txt ") + file("index"));
+		cout << "id " << id << " rejected: " << (status != 0) << endl;
+		assert(status != 0);
+	}
+
+	// binary records whose id does not fit
+	if (sizeof(hf_id_t) < sizeof(long long)){
+		ofstream ostrm(file("bad.bin"), ios::binary);
+		long long id = (long long)((unsigned long long)limits::max() + 1);
+		uint64_t code = 0;
+		ostrm.write((const char*)&id, sizeof(id));
+		ostrm.write((const char*)&code, sizeof(code));
+		ostrm.close();
+		status = run("build -b " + file("bad.bin ") + file("index"));
+		assert(status != 0);
+	}
+}
+
+int main(int argc, char **argv){
+	if (argc != 2){
+		cout << "usage: " << argv[0] << " path/to/hftrie" << endl;
+		return 1;
+	}
+	m_tool = argv[1];
+	m_prefix = "/tmp/hftrie_cli_" + to_string(getpid()) + "_";
+
+	vector<hf_t> entries;
+	for (int i=0;i < n_entries;i++){
+		entries.push_back({ (hf_id_t)(i+1), m_distrib(m_gen) });
+	}
+	vector<uint64_t> queries;
+	for (int i=0;i < n_queries;i++){
+		uint64_t code = entries[i].code;
+		for (int j=0;j < 3;j++){
+			code ^= 0x01ULL << m_bitindex(m_gen);
+		}
+		entries.push_back({ (hf_id_t)(n_entries + i + 1), code });
+		queries.push_back(i % 2 ? code : m_distrib(m_gen));
+	}
+
+	test_build_query_stats(entries, queries);
+	test_bad_ids();
+
+	for (const char *name : { "entries.txt", "entries.bin", "queries", "index", "out", "stats", "bad.txt", "bad.bin" }){
+		unlink(file(name).c_str());
+	}
+
+	cout << "Done." << endl;
+	return 0;
+}
@@ -19,7 +19,9 @@
 
 #include <iostream>
 #include <cassert>
+#include <vector>
 #include "hft/hft.hpp"
+#include "hft/hfperm.hpp"
 
 
 using namespace std;
@@ -38,6 +40,9 @@ void test_ht(){
 	int d = x.hdistance(y);
 	cout << "distance(x, y) = " << d << endl;
 	assert(d == 16);
+
+	cout << "sizeof(hf_t) = " << dec << sizeof(hf_t) << endl;
+	assert(sizeof(hf_t) == sizeof(hf_id_t) + sizeof(uint64_t) || sizeof(hf_id_t) < 4);
 }
 
 void test_mask(){
@@ -61,11 +66,43 @@ void test_mask(){
 }
 
 
+void test_perm(){
+	int order[NDIMS];
+	for (int i=0;i < NDIMS;i++){
+		order[i] = NDIMS - 1 - i;
+	}
+	HFPermutation perm(order);
+	assert(!perm.IsIdentity());
+
+	uint64_t code = 0x0123456789ABCDEFULL;
+	uint64_t key = perm.Apply(code);
+	cout << "perm(" << hex << code << ") = " << key << endl;
+	assert(key == 0xF7B3D591E6A2C480ULL);
+	assert(perm.Invert(key) == code);
+
+	// bits 0..15 constant, so they should be ordered last
+	vector<hf_t> sample;
+	for (uint64_t i=0;i < 4096;i++){
+		uint64_t c = (i*0x9E3779B97F4A7C15ULL) & 0x0000ffffffffffffULL;
+		sample.push_back({ (hf_id_t)i, c | 0xABCD000000000000ULL });
+	}
+	HFPermutation learned = HFPermutation::Learn(sample);
+	for (int i=0;i < NDIMS - 16;i++){
+		assert(learned.GetOrder()[i] >= 16);
+	}
+	for (size_t i=0;i < sample.size();i++){
+		assert(learned.Invert(learned.Apply(sample[i].code)) == sample[i].code);
+		assert(sample[i].hdistance(0) == __builtin_popcountll(learned.Apply(sample[i].code)));
+	}
+}
+
 int main(int argc, char **argv){
 
 	test_ht();
 
 	test_mask();
+
+	test_perm();
 	
 
 	return 0;
@@ -19,9 +19,16 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <random>
+#include <chrono>
+#include <algorithm>
 #include <cassert>
+#include <mutex>
+#include <unistd.h>
 #include "hft/hftrie.hpp"
+#include "hft/hfmulti.hpp"
+#include "hft/hfwindow.hpp"
 
 using namespace std;
 using namespace hft;
@@ -32,8 +39,8 @@ const int n_clusters = 5;
 const int ClusterSize = 10;
 const int Radius = 10;
 
-static long long m_id = 1;
-static long long g_id = 100000;
+static hf_id_t m_id = 1;
+static hf_id_t g_id = 100000;
 
 static random_device m_rd;
 static mt19937_64 m_gen(m_rd());
@@ -115,7 +122,7 @@ void test(){
 		g_id += ClusterSize;
 	}
 
-	long long delid = 100000;
+	hf_id_t delid = 100000;
 	for (int i=0;i < n_clusters;i++){
 		cout << "Delete id = " << dec << delid << " code = " << hex << centers[i] << endl;
 		trie.Delete({delid, centers[i] });
@@ -132,10 +139,1245 @@ void test(){
 	assert(sz == 0);
 }
 
+vector<long long> sorted_ids(const vector<hf_t> &results){
+	vector<long long> ids;
+	for (const hf_t &e : results) ids.push_back(e.id);
+	sort(ids.begin(), ids.end());
+	return ids;
+}
+
+vector<long long> brute_force(const vector<hf_t> &entries, const uint64_t target, const int radius){
+	vector<long long> ids;
+	for (const hf_t &e : entries){
+		if (__builtin_popcountll(e.code^target) <= radius) ids.push_back(e.id);
+	}
+	sort(ids.begin(), ids.end());
+	return ids;
+}
+
+/* true if Load rejects data with a runtime_error */
+bool load_fails(const string &data){
+	stringstream ss(data);
+	HFTrie trie;
+	try {
+		trie.Load(ss);
+	} catch (const runtime_error &e){
+		return true;
+	}
+	return false;
+}
+
+void test_permutation(){
+	cout << "Test learned bit permutation" << endl;
+
+	// skewed data: top 20 bits are nearly constant
+	vector<hf_t> entries;
+	for (int i=0;i < 2000;i++){
+		uint64_t code = (m_distrib(m_gen) & 0x00000fffffffffffULL) | 0xA5A5A00000000000ULL;
+		entries.push_back({ m_id++, code });
+	}
+
+	HFTrie trie;
+	trie.BulkLoad(entries, true);
+	assert(trie.Size() == entries.size());
+	assert(!trie.GetPermutation().IsIdentity());
+
+	for (int i=0;i < 20;i++){
+		uint64_t target = entries[i].code;
+		vector<hf_t> results = trie.RangeSearch(target, 8);
+		assert(sorted_ids(results) == brute_force(entries, target, 8));
+		for (size_t j=0;j < results.size();j++){
+			assert(results[j].hdistance(target) <= 8);
+		}
+	}
+
+	stringstream ss;
+	trie.Save(ss);
+	HFTrie copy;
+	copy.Load(ss);
+	assert(copy.Size() == entries.size());
+	for (int i=0;i < 20;i++){
+		assert(sorted_ids(copy.RangeSearch(entries[i].code, 8)) == brute_force(entries, entries[i].code, 8));
+	}
+
+	// a truncated index, or one whose entry count is corrupt, is rejected
+	string data = ss.str();
+	assert(load_fails(data.substr(0, data.size() - 8)));
+	const uint64_t huge = 0x01ULL << 60;
+	data.replace(20 + NDIMS, sizeof(huge), (const char*)&huge, sizeof(huge));
+	assert(load_fails(data));
+
+	trie.Delete(entries[0]);
+	assert(trie.Size() == entries.size() - 1);
+	trie.Insert(entries[0]);
+	assert(sorted_ids(trie.RangeSearch(entries[0].code, 0)) == brute_force(entries, entries[0].code, 0));
+}
+
+void test_metrics(){
+	cout << "Test metrics" << endl;
+
+	HFTrie trie;
+	trie.EnableMetrics(true);
+	assert(trie.GetMetrics() != NULL);
+
+	vector<hf_t> entries;
+	generate_data(entries, 1000);
+	for (hf_t &e : entries){
+		trie.Insert(e);
+	}
+	for (int i=0;i < 10;i++){
+		trie.RangeSearch(entries[i].code, 4);
+		trie.RangeSearchFast(entries[i].code, 4);
+	}
+	trie.Delete(entries[0]);
+
+	hf_metrics_snapshot_t snapshot = trie.GetMetrics()->Snapshot();
+	assert(snapshot.latency[HF_OP_INSERT].count == 1000);
+	assert(snapshot.latency[HF_OP_DELETE].count == 1);
+	assert(snapshot.latency[HF_OP_RANGESEARCH].count == 10);
+	assert(snapshot.latency[HF_OP_RANGESEARCHFAST].count == 10);
+	assert(snapshot.result_sizes.count == 20);
+	assert(snapshot.counters[HF_CTR_LEAF_SPLITS] > 0);
+	assert(snapshot.latency[HF_OP_INSERT].Percentile(0.5) <= snapshot.latency[HF_OP_INSERT].Percentile(0.99));
+
+	// incremental node counts agree with a fresh count
+	HFTrie other;
+	for (hf_t &e : entries){
+		other.Insert(e);
+	}
+	other.Delete(entries[0]);
+	other.EnableMetrics(true);
+	hf_metrics_snapshot_t counted = other.GetMetrics()->Snapshot();
+	long long n_leaves = 0, n_internal = 0;
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		n_leaves += snapshot.leaf_nodes[l];
+		n_internal += snapshot.internal_nodes[l];
+		assert(snapshot.internal_nodes[l] == counted.internal_nodes[l]);
+		assert(snapshot.leaf_nodes[l] == counted.leaf_nodes[l]);
+	}
+	assert(n_internal == (long long)snapshot.counters[HF_CTR_LEAF_SPLITS]);
+	assert(n_leaves > 0);
+
+	string prom = snapshot.ToPrometheus();
+	string json = snapshot.ToJSON();
+	cout << prom.substr(0, prom.find('\n')) << endl;
+	assert(prom.find("hftrie_op_latency_seconds_count{op=\"insert\"} 1000") != string::npos);
+	assert(json.find("\"leaf_splits\":") != string::npos);
+
+	trie.Clear();
+	snapshot = trie.GetMetrics()->Snapshot();
+	assert(snapshot.leaf_nodes[0] == 0);
+	trie.EnableMetrics(false);
+	assert(trie.GetMetrics() == NULL);
+}
+
+void test_parallel(){
+	cout << "Test parallel range search" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 5000);
+	HFTrie trie;
+	for (hf_t &e : entries){
+		trie.Insert(e);
+	}
+
+	HFThreadPool pool(4);
+	assert(pool.Size() == 4);
+	for (int i=0;i < 10;i++){
+		for (int radius : { 0, 4, 12, 20 }){
+			vector<hf_t> results = trie.RangeSearchParallel(entries[i].code, radius, pool);
+			assert(sorted_ids(results) == sorted_ids(trie.RangeSearch(entries[i].code, radius)));
+			assert(sorted_ids(results) == brute_force(entries, entries[i].code, radius));
+		}
+	}
+}
+
+void test_distances(){
+	cout << "Test search with distances" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 3000);
+	HFTrie trie;
+	for (hf_t &e : entries){
+		trie.Insert(e);
+	}
+
+	for (int i=0;i < 10;i++){
+		uint64_t target = entries[i].code;
+		vector<hf_t> results = { { 0, 0 } };
+		vector<int> distances = { -1 };
+		trie.RangeSearch(target, 12, results, distances, true);
+		assert(results.size() == distances.size());
+		assert(results[0].id == 0 && distances[0] == -1);
+		for (size_t j=1;j < results.size();j++){
+			assert(distances[j] == __builtin_popcountll(results[j].code^target));
+			assert(j == 1 || distances[j-1] <= distances[j]);
+		}
+		results.erase(results.begin());
+		assert(sorted_ids(results) == brute_force(entries, target, 12));
+
+		results.clear();
+		distances.clear();
+		trie.RangeSearchFast(target, 6, results, distances);
+		assert(sorted_ids(results) == sorted_ids(trie.RangeSearchFast(target, 6)));
+		for (size_t j=0;j < results.size();j++){
+			assert(distances[j] == __builtin_popcountll(results[j].code^target));
+		}
+
+		vector<hf_t> nearest = trie.KNearestSearch(target, 10);
+		assert(nearest.size() == 10 && nearest[0].code == target);
+		for (size_t j=1;j < nearest.size();j++){
+			assert(nearest[j-1].hdistance(target) <= nearest[j].hdistance(target));
+		}
+	}
+}
+
+void test_small_radius(){
+	cout << "Test small radius searches" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 2000);
+	HFTrie trie;
+	for (hf_t &e : entries){
+		trie.Insert(e);
+	}
+
+	uniform_int_distribution<int> nflips(0, 4);
+	for (int i=0;i < 50;i++){
+		uint64_t target = entries[i].code;
+		for (int j=nflips(m_gen);j > 0;j--){
+			target ^= (0x01ULL << m_bitindex(m_gen));
+		}
+		for (int radius=0;radius <= 5;radius++){
+			vector<long long> exact = sorted_ids(trie.RangeSearch(target, radius));
+			assert(exact == brute_force(entries, target, radius));
+			vector<long long> fast = sorted_ids(trie.RangeSearchFast(target, radius));
+			assert(includes(exact.begin(), exact.end(), fast.begin(), fast.end()));
+		}
+	}
+}
+
+void check_auto(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target,
+				const int radius, HFThreadPool &pool){
+	assert(sorted_ids(trie.RangeSearchAuto(target, radius)) == brute_force(entries, target, radius));
+	assert(sorted_ids(trie.RangeSearchAuto(target, radius, &pool)) == brute_force(entries, target, radius));
+}
+
+void test_auto(){
+	cout << "Test planned range search" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 200000);
+	HFTrie trie;
+	trie.BulkLoad(entries);
+	trie.EnableFlatScan(true);
+	trie.EnableMetrics(true);
+
+	trie.Delete(entries[0]);
+	entries.erase(entries.begin());
+	hf_t extra = { m_id++, entries[1].code ^ 0x01ULL };
+	trie.Insert(extra);
+	entries.push_back(extra);
+
+	HFThreadPool pool(2);
+	for (int i=0;i < 4;i++){
+		for (int radius : { 0, 2, 6, 16 }){
+			check_auto(trie, entries, entries[i].code, radius, pool);
+		}
+	}
+
+	// small radius stays in the trie, large radius scans, and each is timed
+	// under the path it took
+	uint64_t scans[3], tree[3], flat[3];
+	for (int i=0;i < 3;i++){
+		if (i == 1) trie.RangeSearchAuto(entries[0].code, 1);
+		if (i == 2) trie.RangeSearchAuto(entries[0].code, 20);
+		hf_metrics_snapshot_t snapshot = trie.GetMetrics()->Snapshot();
+		scans[i] = snapshot.counters[HF_CTR_FLAT_SCANS];
+		tree[i] = snapshot.latency[HF_OP_RANGESEARCH].count;
+		flat[i] = snapshot.latency[HF_OP_RANGESEARCHFLAT].count;
+	}
+	cout << "flat scans: " << scans[0] << " " << scans[1] << " " << scans[2]
+		 << ", timed as tree searches " << tree[2] - tree[0] << ", as flat scans " << flat[2] - flat[0] << endl;
+	assert(scans[1] == scans[0] && scans[2] == scans[1] + 1);
+	assert(tree[1] == tree[0] + 1 && tree[2] == tree[1]);
+	assert(flat[1] == flat[0] && flat[2] == flat[1] + 1);
+}
+
+/* memory usage of data loaded into a trie with packed leaves or not */
+size_t loaded_memory(const string &data, const bool packed){
+	stringstream ss(data);
+	HFTrie trie;
+	trie.EnableCompression(packed);
+	trie.Load(ss);
+	return trie.MemoryUsage();
+}
+
+void test_compression(){
+	cout << "Test packed leaves" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 5000);
+	for (int i=0;i < 20;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+	entries.push_back({ (hf_id_t)-5, entries[0].code });
+	entries.push_back({ (hf_id_t)-1000000000000LL, entries[1].code ^ 0x01ULL });
+
+	HFTrie plain, packed;
+	packed.EnableCompression(true);
+	for (hf_t &e : entries){
+		plain.Insert(e);
+		packed.Insert(e);
+	}
+	assert(packed.Size() == entries.size());
+	cout << "memory usage: plain " << plain.MemoryUsage() << ", packed " << packed.MemoryUsage() << endl;
+	assert(packed.MemoryUsage() < plain.MemoryUsage());
+
+	for (int i=0;i < 20;i++){
+		vector<hf_t> results;
+		vector<int> distances;
+		packed.RangeSearch(entries[i].code, 10, results, distances);
+		assert(sorted_ids(results) == brute_force(entries, entries[i].code, 10));
+		for (size_t j=0;j < results.size();j++){
+			assert(results[j].hdistance(entries[i].code) == distances[j]);
+		}
+		assert(sorted_ids(packed.RangeSearchFast(entries[i].code, 4)) == sorted_ids(plain.RangeSearchFast(entries[i].code, 4)));
+	}
+
+	for (int i=0;i < 100;i++){
+		packed.Delete(entries.back());
+		entries.pop_back();
+	}
+	assert(packed.Size() == entries.size());
+
+	// convert back to plain leaves and bulk load into packed leaves
+	packed.EnableCompression(false);
+	assert(sorted_ids(packed.RangeSearch(entries[0].code, 12)) == brute_force(entries, entries[0].code, 12));
+
+	HFTrie bulk;
+	bulk.EnableCompression(true);
+	vector<hf_t> batch(entries);
+	bulk.BulkLoad(move(batch));
+	assert(batch.empty() && bulk.Size() == entries.size());
+	assert(sorted_ids(bulk.RangeSearch(entries[1].code, 12)) == brute_force(entries, entries[1].code, 12));
+
+	// the leaf form is saved with the index; version 1 files keep the current one
+	stringstream ss;
+	bulk.Save(ss);
+	string data = ss.str();
+	string v1 = data.substr(0, 16) + data.substr(20);
+	v1[4] = 1;
+	size_t sizes[] = { bulk.MemoryUsage(), packed.MemoryUsage(), loaded_memory(data, false),
+					   loaded_memory(v1, false), loaded_memory(v1, true) };
+	cout << "memory usage after load: packed " << sizes[2] << ", version 1 " << sizes[3] << " and " << sizes[4] << endl;
+	assert(sizes[2] == sizes[0] && sizes[3] == sizes[1] && sizes[4] == sizes[0]);
+}
+
+/* node counts kept up to date by the trie agree with a fresh count */
+void check_node_counts(HFTrie &trie){
+	hf_metrics_snapshot_t kept = trie.GetMetrics()->Snapshot();
+	trie.EnableMetrics(false);
+	trie.EnableMetrics(true);
+	hf_metrics_snapshot_t counted = trie.GetMetrics()->Snapshot();
+	for (int l=0;l < HF_MAX_LEVELS;l++){
+		assert(kept.internal_nodes[l] == counted.internal_nodes[l]);
+		assert(kept.leaf_nodes[l] == counted.leaf_nodes[l]);
+	}
+}
+
+void test_compact(){
+	cout << "Test merge on delete and compaction" << endl;
+
+	for (bool packed : { false, true }){
+		vector<hf_t> entries;
+		generate_data(entries, 20000);
+		for (int i=0;i < 50;i++){
+			generate_cluster(entries, entries[i].code, ClusterSize);
+		}
+
+		HFTrie trie;
+		trie.EnableCompression(packed);
+		trie.EnableMetrics(true);
+		for (hf_t &e : entries){
+			trie.Insert(e);
+		}
+		size_t peak = trie.MemoryUsage();
+
+		// delete most entries, keeping the clusters
+		shuffle(entries.begin() + 500, entries.end(), m_gen);
+		while (entries.size() > 2000){
+			trie.Delete(entries.back());
+			entries.pop_back();
+		}
+		size_t merged = trie.MemoryUsage();
+		assert(trie.Size() == entries.size());
+		check_node_counts(trie);
+
+		int n_calls = 1;
+		while (!trie.Compact(32)) n_calls++;
+		size_t compacted = trie.MemoryUsage();
+		cout << "memory usage: peak " << peak << ", after deletes " << merged << ", compacted " << compacted
+			 << " (" << n_calls << " calls)" << endl;
+		assert(n_calls > 1 && compacted <= merged && merged < peak);
+		assert(trie.Size() == entries.size());
+		check_node_counts(trie);
+
+		for (int i=0;i < 20;i++){
+			assert(sorted_ids(trie.RangeSearch(entries[i].code, 10)) == brute_force(entries, entries[i].code, 10));
+		}
+
+		// a full pass, then growing again and emptying the trie
+		assert(trie.Compact());
+		for (int i=0;i < 1000;i++){
+			hf_t e = { m_id++, m_distrib(m_gen) };
+			trie.Insert(e);
+			entries.push_back(e);
+		}
+		assert(sorted_ids(trie.RangeSearch(entries.back().code, 8)) == brute_force(entries, entries.back().code, 8));
+		for (hf_t &e : entries){
+			trie.Delete(e);
+		}
+		assert(trie.Size() == 0 && trie.MemoryUsage() == sizeof(HFTrie));
+		check_node_counts(trie);
+	}
+}
+
+/* the smallest budgets still finish a pass, with the same result as a full one */
+void test_compact_budget(){
+	vector<hf_t> entries;
+	generate_data(entries, 20000);
+	for (size_t budget : { 1, 2, 4 }){
+		HFTrie stepped, full;
+		for (hf_t &e : entries){
+			stepped.Insert(e);
+			full.Insert(e);
+		}
+		for (size_t i=0;i < entries.size();i += 3){
+			stepped.Delete(entries[i]);
+			full.Delete(entries[i]);
+		}
+
+		size_t n_calls = 1, max_calls = 4*stepped.Stats().n_internal + 4*stepped.Stats().n_leaves;
+		while (!stepped.Compact(budget) && n_calls < max_calls) n_calls++;
+		cout << "budget " << budget << ": " << n_calls << " calls" << endl;
+		assert(n_calls < max_calls);
+		full.Compact();
+
+		hf_stats_t a = stepped.Stats(), b = full.Stats();
+		assert(a.internal_per_level == b.internal_per_level && a.leaves_per_level == b.leaves_per_level);
+		assert(stepped.MemoryUsage() == full.MemoryUsage());
+		for (int i=0;i < 10;i++){
+			assert(sorted_ids(stepped.RangeSearch(entries[i].code, 10)) == sorted_ids(full.RangeSearch(entries[i].code, 10)));
+		}
+	}
+}
+
+uint64_t sum(const vector<uint64_t> &values){
+	uint64_t total = 0;
+	for (uint64_t v : values){
+		total += v;
+	}
+	return total;
+}
+
+void test_stats(){
+	cout << "Test trie shape statistics" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 50000);
+	HFTrie trie;
+	trie.EnableMetrics(true);
+	for (hf_t &e : entries){
+		trie.Insert(e);
+	}
+
+	hf_stats_t stats = trie.Stats();
+	cout << stats.ToJSON() << endl;
+	hf_metrics_snapshot_t snapshot = trie.GetMetrics()->Snapshot();
+	for (int l=0;l <= NDIMS/CHUNKSIZE;l++){
+		assert((long long)stats.internal_per_level[l] == snapshot.internal_nodes[l]);
+		assert((long long)stats.leaves_per_level[l] == snapshot.leaf_nodes[l]);
+	}
+	assert(stats.n_entries == trie.Size() && sum(stats.entries_per_level) == stats.n_entries);
+	assert(sum(stats.leaf_occupancy) == stats.n_leaves && sum(stats.fanout) == stats.n_internal);
+	assert(stats.internal_bytes + stats.leaf_bytes + sizeof(HFTrie) == trie.MemoryUsage());
+	assert(stats.fanout[0] == 0 && stats.MeanDepth() > 2.0);
+
+	hf_stats_t sampled = trie.Stats(0.25);
+	cout << "sampled entries: " << sampled.n_entries << " of " << stats.n_entries << endl;
+	assert(sampled.n_entries > 0.9*stats.n_entries && sampled.n_entries < 1.1*stats.n_entries);
+	assert(sampled.internal_per_level[0] == 1);
+}
+
+typedef vector<pair<hf_id_t, hf_id_t>> id_pairs_t;
+
+id_pairs_t brute_force_join(const vector<hf_t> &a, const vector<hf_t> &b, const int radius, const bool self){
+	id_pairs_t pairs;
+	for (size_t i=0;i < a.size();i++){
+		for (size_t j=(self ? i+1 : 0);j < b.size();j++){
+			if (a[i].hdistance(b[j].code) > radius) continue;
+			if (self && a[i].id > b[j].id){
+				pairs.push_back({ b[j].id, a[i].id });
+			} else {
+				pairs.push_back({ a[i].id, b[j].id });
+			}
+		}
+	}
+	sort(pairs.begin(), pairs.end());
+	return pairs;
+}
+
+id_pairs_t run_join(const HFTrie &a, const HFTrie *b, const int radius, HFThreadPool *pool){
+	id_pairs_t pairs;
+	mutex lock;
+	hf_pair_fn emit = [&](const hf_t &x, const hf_t &y, const int d){
+		assert(d == x.hdistance(y.code) && d <= radius);
+		lock_guard<mutex> guard(lock);
+		if (b == NULL && x.id > y.id){
+			pairs.push_back({ y.id, x.id });
+		} else {
+			pairs.push_back({ x.id, y.id });
+		}
+	};
+	if (b == NULL){
+		a.SelfJoin(radius, emit, pool);
+	} else {
+		a.SimilarityJoin(*b, radius, emit, pool);
+	}
+	sort(pairs.begin(), pairs.end());
+	return pairs;
+}
+
+void test_join(){
+	cout << "Test similarity joins" << endl;
+
+	vector<hf_t> left, right;
+	generate_data(left, 3000);
+	generate_data(right, 2000);
+	for (int i=0;i < 30;i++){
+		generate_cluster(left, left[i].code, ClusterSize);
+		generate_cluster(right, left[i].code, ClusterSize);
+	}
+	left.push_back({ m_id++, left[0].code });
+
+	HFTrie a, b;
+	a.BulkLoad(left);
+	b.EnableCompression(true);
+	b.BulkLoad(right);
+
+	HFThreadPool pool(3);
+	for (int radius : { 0, 4, 10 }){
+		id_pairs_t self = brute_force_join(left, left, radius, true);
+		id_pairs_t cross = brute_force_join(left, right, radius, false);
+		cout << "radius " << radius << ": " << self.size() << " self pairs, " << cross.size() << " pairs" << endl;
+		assert(run_join(a, NULL, radius, NULL) == self);
+		assert(run_join(a, NULL, radius, &pool) == self);
+		assert(run_join(a, &b, radius, NULL) == cross);
+		assert(run_join(a, &b, radius, &pool) == cross);
+	}
+
+	int order[NDIMS];
+	for (int i=0;i < NDIMS;i++){
+		order[i] = NDIMS - 1 - i;
+	}
+	HFTrie c;
+	c.SetPermutation(HFPermutation(order));
+	c.BulkLoad(right);
+	bool thrown = false;
+	try {
+		run_join(a, &c, 4, NULL);
+	} catch (const invalid_argument &e){
+		thrown = true;
+	}
+	cout << "mismatched permutation rejected: " << thrown << endl;
+	assert(thrown);
+}
+
+void check_multi_search(const HFMultiIndex &index, const vector<hf_t> &entries, const uint64_t target, const int radius){
+	assert(sorted_ids(index.RangeSearch(target, radius)) == brute_force(entries, target, radius));
+}
+
+void check_multi(const int n_substrings){
+	vector<hf_t> entries;
+	generate_data(entries, 2000);
+	for (int i=0;i < 20;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+
+	HFMultiIndex index(n_substrings);
+	for (hf_t &e : entries){
+		index.Insert(e);
+	}
+	assert(index.Size() == entries.size());
+
+	for (int i=0;i < 20;i++){
+		for (int radius : { 0, 3, 8, 12, 20 }){
+			check_multi_search(index, entries, entries[i].code, radius);
+		}
+	}
+
+	for (int i=0;i < 10;i++){
+		index.Delete(entries.back());
+		entries.pop_back();
+	}
+	hf_t extra = { m_id++, entries[0].code };
+	index.Insert(extra);
+	entries.push_back(extra);
+	assert(index.Size() == entries.size());
+
+	for (int i=0;i < 20;i++){
+		check_multi_search(index, entries, entries[i].code, 10);
+	}
+	cout << "substrings " << n_substrings << ", memory usage: " << index.MemoryUsage() << " bytes" << endl;
+}
+
+void test_multi(){
+	cout << "Test multi-index hashing" << endl;
+	check_multi(4);
+	check_multi(3);
+	check_multi(5);
+}
+
+void check_window_search(const HFWindowIndex &window, const vector<hf_t> &live, const uint64_t target, const int radius){
+	vector<hf_t> results;
+	vector<int> distances;
+	window.RangeSearch(target, radius, results, distances, true);
+	assert(sorted_ids(results) == brute_force(live, target, radius));
+	assert(is_sorted(distances.begin(), distances.end()));
+}
+
+void test_window(){
+	cout << "Test windowed index" << endl;
+
+	const int n_generations = 3;
+	HFWindowIndex window(n_generations);
+	vector<vector<hf_t>> generations;
+	for (int g=0;g < 5;g++){
+		if (g > 0) window.Advance();
+		vector<hf_t> entries;
+		generate_data(entries, 500);
+		generate_cluster(entries, entries[0].code, ClusterSize);
+		if (g % 2 == 0){
+			for (hf_t &e : entries) window.Insert(e);
+		} else {
+			window.BulkLoad(entries);
+		}
+		generations.push_back(entries);
+	}
+	assert(window.Generation() == 4);
+
+	vector<hf_t> live;
+	for (int g=5-n_generations;g < 5;g++){
+		live.insert(live.end(), generations[g].begin(), generations[g].end());
+	}
+	assert(window.Size() == live.size());
+	assert(window.GetGeneration(0).Size() == generations[4].size());
+	assert(!window.GetGeneration(0).Empty());
+
+	for (int g=0;g < 5;g++){
+		for (int radius : { 0, 4, 10 }){
+			check_window_search(window, live, generations[g][0].code, radius);
+		}
+	}
+
+	hf_t gone = generations[3][1];
+	window.Delete(gone);
+	live.erase(find_if(live.begin(), live.end(), [&gone](const hf_t &e){ return e.id == gone.id; }));
+	check_window_search(window, live, gone.code, 6);
+
+	vector<hf_t> nearest = window.KNearestSearch(generations[2][0].code, 15);
+	vector<int> expected;
+	for (const hf_t &e : live) expected.push_back(e.hdistance(generations[2][0].code));
+	sort(expected.begin(), expected.end());
+	for (size_t i=0;i < nearest.size();i++){
+		assert(nearest[i].hdistance(generations[2][0].code) == expected[i]);
+	}
+
+	size_t released = window.Reclaim();
+	cout << "released " << released << " entries, memory usage: " << window.MemoryUsage() << " bytes" << endl;
+	assert(released == generations[0].size() + generations[1].size());
+
+	for (int g=0;g < n_generations;g++){
+		window.Advance();
+	}
+	assert(window.Size() == 0);
+	for (int age=0;age < n_generations;age++){
+		assert(window.GetGeneration(age).Empty());
+	}
+	assert(window.Reclaim() == live.size());
+
+	HFTrie drained;
+	assert(drained.Empty());
+	for (const hf_t &e : generations[0]) drained.Insert(e);
+	assert(!drained.Empty());
+	for (const hf_t &e : generations[0]) drained.Delete(e);
+	assert(drained.Empty() && drained.Size() == 0);
+	assert(window.RangeSearch(generations[4][0].code, 10).empty());
+}
+
+void check_exact(const HFTrie &trie, const vector<hf_t> &entries, const vector<uint64_t> &targets){
+	vector<bool> found = trie.Contains(targets);
+	vector<vector<hf_t>> lookups = trie.Lookup(targets);
+	for (size_t i=0;i < targets.size();i++){
+		vector<long long> expected = brute_force(entries, targets[i], 0);
+		vector<hf_t> results;
+		vector<int> distances;
+		trie.RangeSearch(targets[i], 0, results, distances);
+		assert(sorted_ids(results) == expected);
+		assert(sorted_ids(trie.RangeSearchFast(targets[i], 0)) == expected);
+		assert(sorted_ids(lookups[i]) == expected);
+		assert(found[i] == !expected.empty());
+		assert(trie.Contains(targets[i]) == !expected.empty());
+		assert(count(distances.begin(), distances.end(), 0) == (long)distances.size());
+	}
+}
+
+void test_exact(){
+	cout << "Test exact match table" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 5000);
+	for (int i=0;i < 50;i++){
+		entries.push_back({ m_id++, entries[i].code });
+	}
+	entries.push_back({ m_id++, HF_TABLE_EMPTY });
+	entries.push_back({ m_id++, HF_TABLE_EMPTY });
+
+	vector<uint64_t> targets;
+	for (int i=0;i < 100;i++){
+		targets.push_back(entries[i].code);
+		targets.push_back(m_distrib(m_gen));
+	}
+	targets.push_back(HF_TABLE_EMPTY);
+
+	HFTrie trie;
+	trie.BulkLoad(entries, true);
+	check_exact(trie, entries, targets);
+	size_t without = trie.MemoryUsage();
+
+	trie.EnableExactTable(true);
+	check_exact(trie, entries, targets);
+	cout << "memory usage: " << without << " bytes, with table " << trie.MemoryUsage() << " bytes" << endl;
+
+	for (int i=0;i < 5000;i++){
+		hf_t e = { m_id++, m_distrib(m_gen) };
+		trie.Insert(e);
+		entries.push_back(e);
+	}
+	for (int i=0;i < 60;i++){
+		trie.Delete(entries[2*i]);
+	}
+	trie.Delete(entries[5050]);
+	hf_t gone = entries[5050];
+	entries.erase(entries.begin() + 5050);
+	for (int i=59;i >= 0;i--){
+		entries.erase(entries.begin() + 2*i);
+	}
+	targets.push_back(gone.code);
+	assert(trie.Size() == entries.size());
+	check_exact(trie, entries, targets);
+
+	trie.BulkLoad(vector<hf_t>{ { m_id, entries[1].code } });
+	entries.push_back({ m_id++, entries[1].code });
+	check_exact(trie, entries, targets);
+
+	trie.Clear();
+	check_exact(trie, vector<hf_t>(), targets);
+}
+
+void check_cached(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target, const int radius){
+	vector<hf_t> results;
+	vector<int> distances;
+	trie.RangeSearch(target, radius, results, distances, true);
+	assert(sorted_ids(results) == brute_force(entries, target, radius));
+	assert(is_sorted(distances.begin(), distances.end()));
+	for (size_t i=0;i < results.size();i++){
+		assert(results[i].hdistance(target) == distances[i]);
+	}
+	assert(sorted_ids(trie.RangeSearch(target, radius)) == brute_force(entries, target, radius));
+}
+
+uint64_t misses_on_search(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target, const int radius){
+	uint64_t misses = trie.GetCache()->Misses();
+	check_cached(trie, entries, target, radius);
+	return trie.GetCache()->Misses() - misses;
+}
+
+void test_cache(){
+	cout << "Test result cache" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 3000);
+	for (int i=0;i < 20;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+
+	HFTrie trie;
+	trie.BulkLoad(entries, true);
+	trie.EnableMetrics(true);
+	trie.EnableCache(256);
+
+	for (int pass=0;pass < 3;pass++){
+		for (int i=0;i < 20;i++){
+			check_cached(trie, entries, entries[i].code, 4);
+		}
+	}
+	const HFResultCache *cache = trie.GetCache();
+	cout << "hits " << cache->Hits() << ", misses " << cache->Misses() << endl;
+	assert(cache->Misses() == 20 && cache->Hits() == 100);
+	hf_metrics_snapshot_t snapshot = trie.GetMetrics()->Snapshot();
+	assert(snapshot.counters[HF_CTR_CACHE_HITS] == cache->Hits());
+	assert(snapshot.counters[HF_CTR_CACHE_MISSES] == cache->Misses());
+
+	// kNN searches go around the cache
+	const size_t cached = cache->Size();
+	for (int i=20;i < 30;i++){
+		vector<hf_t> nearest = trie.KNearestSearch(entries[i].code, 15);
+		assert(nearest.size() == 15 && nearest[0].hdistance(entries[i].code) == 0);
+		for (size_t j=1;j < nearest.size();j++){
+			assert(nearest[j-1].hdistance(entries[i].code) <= nearest[j].hdistance(entries[i].code));
+		}
+	}
+	cout << "cached after kNN " << cache->Size() << " of " << cached << endl;
+	assert(cache->Size() == cached && cache->Misses() == 20 && cache->Hits() == 100);
+
+	// writes near a target invalidate its results, writes in far away subtrees do not
+	uint64_t target = entries[0].code;
+	hf_t near = { m_id++, target ^ 0x03 };
+	trie.Insert(near);
+	entries.push_back(near);
+	assert(misses_on_search(trie, entries, target, 4) == 1);
+
+	hf_t far = { m_id++, trie.GetPermutation().Invert(~trie.GetPermutation().Apply(target)) };
+	trie.Insert(far);
+	entries.push_back(far);
+	assert(misses_on_search(trie, entries, target, 4) == 0);
+
+	trie.Delete(near);
+	entries.erase(entries.end() - 2);
+	assert(misses_on_search(trie, entries, target, 4) == 1);
+	check_cached(trie, entries, target, 0);
+
+	// more distinct queries than slots
+	for (int i=0;i < 600;i++){
+		check_cached(trie, entries, entries[i].code, 2 + i % 3);
+	}
+	assert(cache->Size() <= 256);
+	cout << "cached " << cache->Size() << ", memory usage: " << cache->MemoryUsage() << " bytes" << endl;
+
+	trie.BulkLoad(vector<hf_t>{ { m_id, target } });
+	entries.push_back({ m_id++, target });
+	check_cached(trie, entries, target, 4);
+	trie.Clear();
+	check_cached(trie, vector<hf_t>(), target, 4);
+}
+
+void check_root_table(const HFTrie &trie, const HFTrie &plain, const vector<hf_t> &entries, const uint64_t target,
+					  HFThreadPool *pool=NULL){
+	for (int radius : { 0, 1, 3, 6, 10, 20 }){
+		vector<hf_t> results;
+		vector<int> distances;
+		trie.RangeSearch(target, radius, results, distances);
+		assert(sorted_ids(results) == brute_force(entries, target, radius));
+		assert(sorted_ids(trie.RangeSearch(target, radius)) == sorted_ids(results));
+		assert(sorted_ids(trie.RangeSearchFast(target, radius)) == sorted_ids(plain.RangeSearchFast(target, radius)));
+		assert(pool == NULL || sorted_ids(trie.RangeSearchParallel(target, radius, *pool)) == sorted_ids(results));
+	}
+}
+
+/**
+ * mean time of inserts into a trie over entries with a root table of bits,
+ * and the root table slots they wrote per insert
+ **/
+double insert_usecs(const vector<hf_t> &entries, const int bits, double &slots){
+	HFTrie trie;
+	trie.BulkLoad(entries);
+	trie.SetRootBits(bits);
+	trie.EnableMetrics(true);
+	const int n = 20000;
+	vector<hf_t> added;
+	generate_data(added, n);
+	auto s = chrono::steady_clock::now();
+	for (const hf_t &e : added){
+		trie.Insert(e);
+	}
+	double usecs = chrono::duration<double, micro>(chrono::steady_clock::now() - s).count()/n;
+	slots = (double)trie.GetMetrics()->Snapshot().counters[HF_CTR_ROOT_SLOTS]/n;
+	return usecs;
+}
+
+void test_root_table(){
+	cout << "Test root table" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 20000);
+	for (int i=0;i < 20;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+
+	HFThreadPool pool(3);
+	HFTrie plain, trie;
+	plain.BulkLoad(entries);
+	trie.BulkLoad(entries);
+	for (int bits : { 4, 8, 12, 16, HF_ROOT_AUTO }){
+		trie.SetRootBits(bits);
+		cout << "root bits " << trie.GetRootBits() << ", memory usage: " << trie.MemoryUsage() << " bytes" << endl;
+		assert(bits == HF_ROOT_AUTO || trie.GetRootBits() == bits);
+		for (int i=0;i < 20;i++){
+			check_root_table(trie, plain, entries, entries[i].code, &pool);
+		}
+	}
+
+	// the table follows inserts and deletes, starting from an empty trie
+	HFTrie grown;
+	grown.SetRootBits(8);
+	HFTrie grown_plain;
+	for (size_t i=0;i < 3000;i++){
+		grown.Insert(entries[i]);
+		grown_plain.Insert(entries[i]);
+	}
+	vector<hf_t> kept(entries.begin(), entries.begin() + 3000);
+	for (int i=0;i < 20;i++){
+		check_root_table(grown, grown_plain, kept, entries[i].code);
+	}
+	for (size_t i=100;i < 3000;i++){
+		grown.Delete(entries[i]);
+		grown_plain.Delete(entries[i]);
+	}
+	kept.resize(100);
+	grown.Compact();
+	grown_plain.Compact();
+	for (int i=0;i < 20;i++){
+		check_root_table(grown, grown_plain, kept, entries[i].code);
+	}
+
+	// slots are patched under each write, and the auto depth follows the trie
+	// as it grows from empty and shrinks again
+	for (int bits : { 12, HF_ROOT_AUTO }){
+		HFTrie patched, patched_plain;
+		patched.SetRootBits(bits);
+		for (hf_t &e : entries){
+			patched.Insert(e);
+			patched_plain.Insert(e);
+		}
+		const int grown_bits = patched.GetRootBits();
+		for (int i=0;i < 20;i++){
+			check_root_table(patched, patched_plain, entries, entries[i].code);
+		}
+
+		vector<hf_t> left(entries.begin(), entries.begin() + 300);
+		for (size_t i=left.size();i < entries.size();i++){
+			patched.Delete(entries[i]);
+			patched_plain.Delete(entries[i]);
+		}
+		while (!patched.Compact(16));
+		patched_plain.Compact();
+		cout << "root bits " << grown_bits << " grown, " << patched.GetRootBits() << " shrunk" << endl;
+		assert(bits != HF_ROOT_AUTO || (grown_bits > 0 && patched.GetRootBits() < grown_bits));
+		for (int i=0;i < 20;i++){
+			check_root_table(patched, patched_plain, left, entries[i].code);
+		}
+	}
+
+	vector<hf_t> bulk;
+	generate_data(bulk, 200000);
+	double plain_slots, table_slots, auto_slots;
+	double plain_usecs = insert_usecs(bulk, 0, plain_slots), table_usecs = insert_usecs(bulk, 16, table_slots);
+	double auto_usecs = insert_usecs(bulk, HF_ROOT_AUTO, auto_slots);
+	cout << "insert usecs: " << plain_usecs << " without table, " << table_usecs << " with 16 bits, "
+		 << auto_usecs << " auto" << endl;
+	cout << "root slots written per insert: " << table_slots << " with 16 bits, " << auto_slots << " auto" << endl;
+	// inserts patch the slots under the node they change, not the whole table
+	assert(plain_slots == 0 && table_slots < 2 && auto_slots < NODE_FANOUT);
+
+	bool thrown = false;
+	try {
+		grown.SetRootBits(6);
+	} catch (const invalid_argument &e){
+		thrown = true;
+	}
+	cout << "bad width rejected: " << thrown << endl;
+	assert(thrown);
+}
+
+vector<long long> brute_force_masked(const vector<hf_t> &entries, const uint64_t target, const uint64_t mask,
+									 const int radius){
+	vector<long long> ids;
+	for (const hf_t &e : entries){
+		if (__builtin_popcountll((e.code^target) & mask) <= radius) ids.push_back(e.id);
+	}
+	sort(ids.begin(), ids.end());
+	return ids;
+}
+
+void check_masked_search(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target, const uint64_t mask,
+						 const int radius){
+	assert(sorted_ids(trie.RangeSearchMasked(target, mask, radius)) == brute_force_masked(entries, target, mask, radius));
+}
+
+void check_masked(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target){
+	assert(sorted_ids(trie.RangeSearchMasked(target, ~0ULL, 6)) == brute_force(entries, target, 6));
+	assert(trie.RangeSearchMasked(target, 0, 0).size() == entries.size());
+	assert(trie.RangeSearchMasked(target, ~0ULL, -1).empty());
+
+	const uint64_t masks[] = { 0xffffffff00000000ULL, 0x0f0f0f0f0f0f0f0fULL, 0xfffffffffffff0ffULL,
+							   m_distrib(m_gen), m_distrib(m_gen) & m_distrib(m_gen) };
+	for (uint64_t mask : masks){
+		for (int radius : { 0, 3, 8 }){
+			check_masked_search(trie, entries, target, mask, radius);
+		}
+	}
+}
+
+void test_masked(){
+	cout << "Test masked range search" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 5000);
+	for (int i=0;i < 20;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+
+	HFTrie trie;
+	trie.BulkLoad(entries);
+	trie.EnableMetrics(true);
+	for (int i=0;i < 20;i++){
+		check_masked(trie, entries, entries[i].code);
+	}
+	hf_metrics_snapshot_t snapshot = trie.GetMetrics()->Snapshot();
+	cout << "masked searches timed: " << snapshot.latency[HF_OP_RANGESEARCHMASKED].count << endl;
+	assert(snapshot.latency[HF_OP_RANGESEARCHMASKED].count == 20*18);
+	assert(snapshot.latency[HF_OP_RANGESEARCH].count == 0);
+
+	HFTrie learned;
+	learned.EnableCompression(true);
+	learned.BulkLoad(entries, true);
+	for (int i=0;i < 20;i++){
+		check_masked(learned, entries, entries[i].code);
+	}
+
+	// flipping only don't care bits keeps an entry at distance 0
+	uint64_t target = entries[0].code ^ 0x00000000000000f0ULL;
+	vector<hf_t> results = trie.RangeSearchMasked(target, 0xffffffffffffff0fULL, 0);
+	cout << "matches ignoring 4 bits: " << results.size() << endl;
+	assert(find_if(results.begin(), results.end(), [&entries](const hf_t &e){ return e.id == entries[0].id; }) != results.end());
+}
+
+/* runs a bounded search to the end; n_calls receives the number of calls it took */
+vector<hf_t> search_bounded(const HFTrie &trie, const uint64_t target, const int radius, const hf_bounds_t &bounds,
+							const bool fast, int &n_calls){
+	vector<hf_t> results;
+	HFContinuation cont;
+	n_calls = 1;
+	bool done = trie.RangeSearchBounded(target, radius, bounds, results, cont, fast);
+	while (!done){
+		done = trie.Resume(cont, bounds, results);
+		n_calls++;
+	}
+	assert(cont.Done() && cont.Pending() == 0);
+	return results;
+}
+
+/* returns the number of calls a radius 10 search took with a budget of 200 ops */
+int check_bounded(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target){
+	int n_calls = 0;
+	vector<hf_t> results = search_bounded(trie, target, 4, { 0, 0 }, false, n_calls);
+	assert(n_calls == 1 && sorted_ids(results) == brute_force(entries, target, 4));
+
+	results = search_bounded(trie, target, 10, { 0, 200 }, true, n_calls);
+	assert(sorted_ids(results) == sorted_ids(trie.RangeSearchFast(target, 10)));
+
+	results = search_bounded(trie, target, 10, { 0, 200 }, false, n_calls);
+	assert(sorted_ids(results) == brute_force(entries, target, 10));
+	return n_calls;
+}
+
+void test_bounded(){
+	cout << "Test bounded range search" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 20000);
+	for (int i=0;i < 50;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+
+	int n_calls = 0;
+	for (bool packed : { false, true }){
+		HFTrie trie;
+		trie.EnableCompression(packed);
+		trie.BulkLoad(entries);
+		int total_calls = 0;
+		for (int i=0;i < 10;i++){
+			total_calls += check_bounded(trie, entries, entries[i].code);
+		}
+		cout << "calls per radius 10 search with a budget of 200 ops: " << total_calls/10 << endl;
+		assert(total_calls > 10);
+		vector<hf_t> results = search_bounded(trie, entries[0].code, 20, { 200, 0 }, false, n_calls);
+		assert(sorted_ids(results) == brute_force(entries, entries[0].code, 20));
+		cout << "calls for a radius 20 search with a 200us deadline: " << n_calls << endl;
+	}
+
+	// deletes between calls merge pending subtrees into shallower leaves
+	HFTrie trie;
+	trie.BulkLoad(entries);
+	const uint64_t target = entries[0].code;
+	const vector<long long> before = brute_force(entries, target, 20);
+	HFContinuation cont;
+	vector<hf_t> results;
+	trie.RangeSearchBounded(target, 20, { 0, 100 }, results, cont);
+	assert(!cont.Done());
+
+	shuffle(entries.begin() + 500, entries.end(), m_gen);
+	while (entries.size() > 2000){
+		trie.Delete(entries.back());
+		entries.pop_back();
+	}
+	while (!trie.Resume(cont, { 0, 100 }, results));
+
+	vector<long long> ids = sorted_ids(results);
+	vector<long long> after = brute_force(entries, target, 20);
+	cout << "results across deletes: " << ids.size() << " of " << before.size() << " before, " << after.size() << " after" << endl;
+	assert(adjacent_find(ids.begin(), ids.end()) == ids.end());
+	assert(includes(before.begin(), before.end(), ids.begin(), ids.end()));
+	assert(includes(ids.begin(), ids.end(), after.begin(), after.end()));
+
+	// the pending prefixes are in the key space of the permutation the search started with
+	trie.RangeSearchBounded(target, 20, { 0, 100 }, results, cont);
+	int order[NDIMS];
+	for (int i=0;i < NDIMS;i++){
+		order[i] = NDIMS - 1 - i;
+	}
+	trie.SetPermutation(HFPermutation(order));
+	bool thrown = false;
+	try {
+		trie.Resume(cont, { 0, 100 }, results);
+	} catch (const invalid_argument &e){
+		thrown = true;
+	}
+	cout << "resume after a new permutation rejected: " << thrown << endl;
+	assert(thrown);
+}
+
+void check_tiered(const HFTrie &trie, const vector<hf_t> &entries, const uint64_t target){
+	assert(sorted_ids(trie.RangeSearch(target, 8)) == brute_force(entries, target, 8));
+	assert(sorted_ids(trie.RangeSearchFast(target, 4)).size() <= brute_force(entries, target, 4).size());
+	assert(sorted_ids(trie.RangeSearch(target, 0)) == brute_force(entries, target, 0));
+}
+
+void test_tiering(){
+	cout << "Test tiered leaf storage" << endl;
+
+	vector<hf_t> entries;
+	generate_data(entries, 20000);
+	for (int i=0;i < 50;i++){
+		generate_cluster(entries, entries[i].code, ClusterSize);
+	}
+
+	HFTrie plain;
+	plain.BulkLoad(entries);
+
+	// a budget of one page per shard, so that most reads go to the file
+	const string path = "/tmp/hftrie_store_" + to_string(getpid()) + ".dat";
+	HFTrie trie;
+	trie.BulkLoad(entries);
+	trie.EnableTiering(path, HF_STORE_SHARDS*HF_STORE_PAGE);
+	assert(trie.GetStore() != NULL && trie.Size() == entries.size());
+	for (int i=0;i < 20;i++){
+		check_tiered(trie, entries, entries[i].code);
+	}
+	const HFLeafStore *store = trie.GetStore();
+	cout << "memory usage: " << trie.MemoryUsage() << " tiered, " << plain.MemoryUsage() << " in memory; "
+		 << store->FileSize() << " bytes in file, " << store->Misses() << " of " << store->Reads() << " page reads missed" << endl;
+	assert(trie.MemoryUsage() < plain.MemoryUsage() && store->Misses() > 0);
+	assert(store->Resident() <= HF_STORE_SHARDS*HF_STORE_PAGE);
+
+	// splits, merges and compaction rewrite extents
+	for (int i=0;i < 2000;i++){
+		hf_t e = { m_id++, entries[i].code ^ (0x01ULL << (i % 64)) };
+		trie.Insert(e);
+		entries.push_back(e);
+	}
+	shuffle(entries.begin(), entries.end(), m_gen);
+	while (entries.size() > 5000){
+		trie.Delete(entries.back());
+		entries.pop_back();
+	}
+	while (!trie.Compact(64));
+	assert(trie.Size() == entries.size());
+	for (int i=0;i < 20;i++){
+		check_tiered(trie, entries, entries[i].code);
+	}
+
+	stringstream ss;
+	trie.Save(ss);
+	HFTrie loaded;
+	loaded.EnableTiering(path, 1 << 20);
+	loaded.Load(ss);
+	assert(loaded.Size() == entries.size());
+	check_tiered(loaded, entries, entries[0].code);
+
+	// back into memory
+	trie.EnableTiering("", 0);
+	assert(trie.GetStore() == NULL && trie.Size() == entries.size());
+	check_tiered(trie, entries, entries[1].code);
+
+	for (hf_t &e : entries){
+		loaded.Delete(e);
+	}
+	assert(loaded.Size() == 0 && loaded.GetStore()->FileSize() == 0);
+
+	bool thrown = false;
+	try {
+		trie.EnableTiering("/nonexistent/hftrie.dat", 0);
+	} catch (const runtime_error &e){
+		thrown = true;
+	}
+	cout << "bad store path rejected: " << thrown << endl;
+	assert(thrown && trie.GetStore() == NULL && trie.Size() == entries.size());
+}
+
 int main(int argc, char **argv){
 
 	test();
 
+	test_permutation();
+
+	test_metrics();
+
+	test_parallel();
+
+	test_distances();
+
+	test_small_radius();
+
+	test_auto();
+
+	test_multi();
+
+	test_compression();
+
+	test_compact();
+	test_compact_budget();
+
+	test_stats();
+
+	test_join();
+
+	test_window();
+
+	test_exact();
+
+	test_cache();
+
+	test_root_table();
+
+	test_masked();
+
+	test_bounded();
+
+	test_tiering();
+
 	
 	return 0;
 }
@@ -0,0 +1,275 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <cassert>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hft/hftrie.hpp"
+#include "hft/hfserver.hpp"
+#include "hft/hfclient.hpp"
+#include "hft/hfshard.hpp"
+
+using namespace std;
+using namespace hft;
+
+const int n_entries = 2000;
+
+static random_device m_rd;
+static mt19937_64 m_gen(m_rd());
+static uniform_int_distribution<uint64_t> m_distrib(0);
+
+vector<long long> sorted_ids(const vector<hf_t> &results){
+	vector<long long> ids;
+	for (const hf_t &e : results) ids.push_back(e.id);
+	sort(ids.begin(), ids.end());
+	return ids;
+}
+
+void test_proto(){
+	cout << "Test protocol encoding" << endl;
+
+	string buf;
+	hf_request_t req(HF_MSG_RANGE, 7, 0xABCDULL, 5);
+	req.req_id = 3;
+	EncodeRequest(req, buf);
+
+	hf_request_t decoded;
+	assert(DecodeRequest(buf.data(), buf.size()-1, decoded) == 0);
+	assert(DecodeRequest(buf.data(), buf.size(), decoded) == buf.size());
+	assert(decoded.req_id == 3 && decoded.type == HF_MSG_RANGE);
+	assert(decoded.id == 7 && decoded.code == 0xABCDULL && decoded.param == 5);
+
+	buf.clear();
+	hf_response_t resp;
+	resp.req_id = 3;
+	resp.type = HF_MSG_RANGE;
+	resp.results = { { 1, 0x01ULL }, { 2, 0x02ULL } };
+	resp.count = resp.results.size();
+	EncodeResponse(resp, buf);
+
+	hf_response_t out;
+	assert(DecodeResponse(buf.data(), buf.size(), out) == buf.size());
+	assert(out.count == 2 && out.results.size() == 2 && out.results[1].code == 0x02ULL);
+}
+
+/* a range search over the whole trie, answered on its own */
+hf_response_t over_limit(HFClient &client, const uint64_t target){
+	client.Send({ HF_MSG_RANGE, 0, target, 64 });
+	client.Flush();
+	hf_response_t resp;
+	client.Receive(resp);
+	return resp;
+}
+
+void test_server(){
+	cout << "Test server" << endl;
+
+	string path = "/tmp/hftrie_test_" + to_string(getpid()) + ".sock";
+
+	HFTrie trie;
+	HFServer server(trie, 2);
+	server.ListenUnix(path);
+	thread loop([&]{ server.Run(); });
+
+	HFClient client;
+	client.ConnectUnix(path);
+
+	vector<hf_t> entries;
+	for (int i=0;i < n_entries;i++){
+		entries.push_back({ (hf_id_t)(i+1), m_distrib(m_gen) });
+	}
+
+	// pipeline all inserts, then read back every response
+	for (hf_t &e : entries){
+		client.Send({ HF_MSG_INSERT, e.id, e.code, 0 });
+	}
+	client.Flush();
+	for (int i=0;i < n_entries;i++){
+		hf_response_t resp;
+		client.Receive(resp);
+		assert(resp.status == HF_STATUS_OK && resp.type == HF_MSG_INSERT);
+		assert(resp.req_id == (uint32_t)(i+1));
+	}
+	assert(trie.Size() == n_entries);
+
+	HFClient other;
+	other.ConnectUnix(path);
+	for (int i=0;i < 20;i++){
+		uint64_t target = entries[i].code;
+		vector<hf_t> results = client.RangeSearch(target, 10);
+		assert(sorted_ids(results) == sorted_ids(trie.RangeSearch(target, 10)));
+		assert(other.Count(target, 10) == results.size());
+		assert(sorted_ids(other.RangeSearchFast(target, 4)) == sorted_ids(trie.RangeSearchFast(target, 4)));
+
+		vector<hf_t> nearest = client.KNearestSearch(target, 5);
+		assert(nearest.size() == 5);
+		assert(nearest[0].code == target);
+	}
+
+	client.Delete(entries[0]);
+	assert(trie.Size() == n_entries - 1);
+	assert(other.Count(entries[0].code, 0) == 0);
+
+	// a result set over the limit gets an error and its size, and the
+	// connection stays usable
+	server.SetMaxResults(100);
+	hf_response_t resp = over_limit(client, entries[1].code);
+	cout << "too many results: status " << (int)resp.status << ", count " << resp.count << endl;
+	assert(resp.status == HF_STATUS_TOOMANY && resp.count == n_entries - 1 && resp.results.empty());
+	bool thrown = false;
+	try {
+		client.KNearestSearch(entries[1].code, 200);
+	} catch (const runtime_error &e){
+		thrown = true;
+	}
+	cout << "oversized knn rejected: " << thrown << endl;
+	assert(thrown);
+	assert(client.Count(entries[1].code, 64) == n_entries - 1);
+	assert(client.KNearestSearch(entries[1].code, 100).size() == 100);
+
+	client.Close();
+	other.Close();
+	server.Stop();
+	loop.join();
+}
+
+/* fork a shard server process listening on path */
+pid_t start_shard(const string &path){
+	pid_t pid = fork();
+	if (pid == 0){
+		HFTrie trie;
+		HFServer server(trie, 1);
+		server.ListenUnix(path);
+		server.Run();
+		_exit(0);
+	}
+	return pid;
+}
+
+void connect_shard(HFCoordinator &coordinator, const string &path){
+	for (int attempt=0;;attempt++){
+		try {
+			coordinator.AddShardUnix(path);
+			return;
+		} catch (const runtime_error &err){
+			if (attempt == 100) throw;
+			usleep(20000);
+		}
+	}
+}
+
+void check_gather(HFCoordinator &coordinator, const HFTrie &trie, const uint64_t target, const int radius){
+	int n_emitted = 0;
+	hf_gather_t gather = coordinator.RangeSearch(target, radius, [&](const int shard, const vector<hf_t> &results){
+		n_emitted++;
+	});
+	assert(gather.Complete() && n_emitted == gather.n_shards);
+	assert(sorted_ids(gather.results) == sorted_ids(trie.RangeSearch(target, radius)));
+	assert(coordinator.Count(target, radius).count == gather.results.size());
+	assert(coordinator.RangeSearchFast(target, radius).results.size() <= gather.results.size());
+}
+
+bool excludes_shard(const HFCoordinator &coordinator, const vector<hf_t> &results, const int shard){
+	for (const hf_t &e : results){
+		if (coordinator.ShardOf(e.code) == shard) return false;
+	}
+	return true;
+}
+
+void test_shards(){
+	cout << "Test sharded deployment" << endl;
+
+	const int n_shards = 4;
+	vector<string> paths;
+	vector<pid_t> pids;
+	for (int i=0;i < n_shards;i++){
+		paths.push_back("/tmp/hftrie_shard_" + to_string(getpid()) + "_" + to_string(i) + ".sock");
+		pids.push_back(start_shard(paths.back()));
+	}
+
+	HFCoordinator coordinator;
+	for (const string &path : paths){
+		connect_shard(coordinator, path);
+	}
+	assert(coordinator.NumShards() == n_shards);
+
+	// the same entries in one local trie, for reference
+	HFTrie trie;
+	vector<hf_t> entries;
+	for (int i=0;i < n_entries;i++){
+		entries.push_back({ (hf_id_t)(i+1), m_distrib(m_gen) });
+		coordinator.Insert(entries.back());
+		trie.Insert(entries.back());
+	}
+
+	for (int i=0;i < 20;i++){
+		for (int radius : { 0, 1, 4, 10 }){
+			check_gather(coordinator, trie, entries[i].code, radius);
+		}
+	}
+	hf_gather_t narrow = coordinator.RangeSearch(entries[0].code, 0);
+	hf_gather_t wide = coordinator.RangeSearch(entries[0].code, 10);
+	cout << "shards queried at radius 0: " << narrow.n_shards << ", at radius 10: " << wide.n_shards << endl;
+	assert(narrow.n_shards == 1 && wide.n_shards == n_shards);
+
+	hf_gather_t nearest = coordinator.KNearestSearch(entries[5].code, 5);
+	assert(nearest.results.size() == 5 && nearest.results[0].code == entries[5].code);
+
+	coordinator.Delete(entries[0]);
+	trie.Delete(entries[0]);
+	check_gather(coordinator, trie, entries[0].code, 4);
+
+	// a stalled shard misses the deadline, and its late response is skipped later
+	const int stalled = coordinator.ShardOf(entries[1].code);
+	kill(pids[stalled], SIGSTOP);
+	coordinator.SetTimeout(200);
+	hf_gather_t partial = coordinator.RangeSearch(entries[1].code, 10);
+	cout << "timeouts with a stalled shard: " << partial.n_timeouts << endl;
+	assert(partial.n_timeouts == 1 && !partial.Complete());
+	assert(excludes_shard(coordinator, partial.results, stalled));
+	kill(pids[stalled], SIGCONT);
+	coordinator.SetTimeout(5000);
+	check_gather(coordinator, trie, entries[1].code, 10);
+	coordinator.Insert({ (hf_id_t)(n_entries+1), entries[1].code });
+	trie.Insert({ (hf_id_t)(n_entries+1), entries[1].code });
+	check_gather(coordinator, trie, entries[1].code, 2);
+
+	for (int i=0;i < n_shards;i++){
+		kill(pids[i], SIGTERM);
+		waitpid(pids[i], NULL, 0);
+		unlink(paths[i].c_str());
+	}
+}
+
+int main(int argc, char **argv){
+
+	test_proto();
+
+	test_server();
+
+	test_shards();
+
+	return 0;
+}
@@ -0,0 +1,446 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hft/hftrie.hpp"
+#include "hft/hfmetrics.hpp"
+#include "hft/hfpool.hpp"
+
+using namespace std;
+using namespace hft;
+
+/* binary records are a little endian int64 id followed by a uint64 code */
+#define RECORD_SIZE 16
+
+/* bytes of text parsed per task */
+#define PARSE_CHUNK (1 << 22)
+
+static void usage(){
+	cout << "usage: hftrie build [-b] [-t threads] [-l] [-c] input index" << endl;
+	cout << "       hftrie query [-b] [-t threads] [-m exact|fast|auto|knn] [-r radius] [-k k] [-o output] index queries" << endl;
+	cout << "       hftrie stats [-s sample] index" << endl;
+	cout << endl;
+	cout << "  input holds one \"id code\" pair per line, code in hex, or binary" << endl;
+	cout << "  (id, code) records of 16 bytes with -b.  queries holds one hex code" << endl;
+	cout << "  per line, or binary 8 byte codes with -b." << endl;
+	cout << "  -t   number of threads (default: all cores)" << endl;
+	cout << "  -l   learn a bit permutation from the input" << endl;
+	cout << "  -c   store leaves in packed form, kept by the saved index" << endl;
+	cout << "  -m   search mode (default exact); auto runs one query at a time," << endl;
+	cout << "       giving the threads to the flat scans it plans" << endl;
+	cout << "  -r   search radius (default 10)" << endl;
+	cout << "  -k   number of neighbors for knn (default 10)" << endl;
+	cout << "  -o   write results to output instead of stdout" << endl;
+	cout << "  -s   fraction of subtrees to sample (default 1)" << endl;
+}
+
+static double seconds_since(const chrono::steady_clock::time_point &start){
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Read-only memory map of a whole file.
+ **/
+class mapped_file_t {
+private:
+	const char *m_data;
+	size_t m_size;
+public:
+	mapped_file_t(const string &path){
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw runtime_error("unable to open " + path);
+		struct stat st;
+		if (fstat(fd, &st) < 0){
+			close(fd);
+			throw runtime_error("unable to stat " + path);
+		}
+		m_size = st.st_size;
+		m_data = NULL;
+		if (m_size > 0){
+			void *addr = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (addr == MAP_FAILED){
+				close(fd);
+				throw runtime_error("unable to map " + path);
+			}
+			madvise(addr, m_size, MADV_SEQUENTIAL);
+			m_data = (const char*)addr;
+		}
+		close(fd);
+	}
+	~mapped_file_t(){
+		if (m_data != NULL) munmap((void*)m_data, m_size);
+	}
+	mapped_file_t(const mapped_file_t &other) = delete;
+	mapped_file_t& operator=(const mapped_file_t &other) = delete;
+
+	const char* data()const { return m_data; }
+	size_t size()const { return m_size; }
+};
+
+static inline const char* skip_space(const char *p, const char *end){
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+/* ids outside the range of hf_id_t are rejected rather than wrapped */
+static const char* parse_id(const char *p, const char *end, hf_id_t &id){
+	typedef numeric_limits<hf_id_t> limits;
+	bool neg = (p < end && *p == '-');
+	if (neg) p++;
+	if (p == end || *p < '0' || *p > '9') throw runtime_error("bad id");
+	const unsigned long long limit = !neg ? (unsigned long long)limits::max()
+		: limits::is_signed ? (unsigned long long)(-(limits::min() + 1)) + 1 : 0;
+	unsigned long long v = 0;
+	for (;p < end && *p >= '0' && *p <= '9';p++){
+		unsigned int digit = *p - '0';
+		if (digit > limit || v > (limit - digit)/10) throw runtime_error("id out of range");
+		v = 10*v + digit;
+	}
+	id = neg ? (hf_id_t)(0ULL - v) : (hf_id_t)v;
+	return p;
+}
+
+static const char* parse_code(const char *p, const char *end, uint64_t &code){
+	if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+	const char *start = p;
+	code = 0;
+	for (;p < end;p++){
+		int digit;
+		if (*p >= '0' && *p <= '9') digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+		else break;
+		code = (code << 4) | digit;
+	}
+	if (p == start || p - start > 16) throw runtime_error("bad code");
+	return p;
+}
+
+/* split text into chunks of about PARSE_CHUNK bytes that end on line boundaries */
+static vector<pair<size_t, size_t>> split_lines(const char *data, const size_t size){
+	vector<pair<size_t, size_t>> chunks;
+	size_t start = 0;
+	while (start < size){
+		size_t end = min(start + PARSE_CHUNK, size);
+		const char *nl = (end < size) ? (const char*)memchr(data + end, '\n', size - end) : NULL;
+		end = (nl != NULL) ? nl - data + 1 : size;
+		chunks.push_back({ start, end });
+		start = end;
+	}
+	return chunks;
+}
+
+/**
+ * Parse a text file of "id code" lines or a binary file of records into entries,
+ * using the workers of pool.  Blank lines and lines starting with # are skipped.
+ **/
+template<typename T, typename ParseLine>
+static vector<T> parse_file(const mapped_file_t &file, const bool binary, const size_t record_size,
+							HFThreadPool &pool, ParseLine parse_line, T (*parse_record)(const char*)){
+	vector<T> items;
+	if (binary){
+		if (file.size() % record_size != 0) throw runtime_error("truncated binary file");
+		const size_t n = file.size()/record_size;
+		items.resize(n);
+		const size_t per_task = PARSE_CHUNK/record_size;
+		const size_t n_tasks = (n + per_task - 1)/per_task;
+		vector<string> errors(n_tasks);
+		pool.ParallelFor(n_tasks, [&](size_t task, int worker){
+			size_t i = task*per_task;
+			try {
+				for (;i < min(n, (task+1)*per_task);i++){
+					items[i] = parse_record(file.data() + i*record_size);
+				}
+			} catch (const exception &err){
+				errors[task] = string(err.what()) + " in record " + to_string(i);
+			}
+		});
+		for (const string &error : errors){
+			if (!error.empty()) throw runtime_error(error);
+		}
+		return items;
+	}
+
+	vector<pair<size_t, size_t>> chunks = split_lines(file.data(), file.size());
+	vector<vector<T>> parts(chunks.size());
+	vector<string> errors(chunks.size());
+	pool.ParallelFor(chunks.size(), [&](size_t task, int worker){
+		const char *p = file.data() + chunks[task].first, *end = file.data() + chunks[task].second;
+		try {
+			while (p < end){
+				const char *eol = (const char*)memchr(p, '\n', end - p);
+				if (eol == NULL) eol = end;
+				const char *q = skip_space(p, eol);
+				if (q < eol && *q != '#'){
+					parts[task].push_back(parse_line(q, eol));
+				}
+				p = eol + 1;
+			}
+		} catch (const exception &err){
+			errors[task] = string(err.what()) + " near offset " + to_string(p - file.data());
+		}
+	});
+	size_t n = 0;
+	for (size_t i=0;i < chunks.size();i++){
+		if (!errors[i].empty()) throw runtime_error(errors[i]);
+		n += parts[i].size();
+	}
+	items.reserve(n);
+	for (vector<T> &part : parts){
+		items.insert(items.end(), part.begin(), part.end());
+	}
+	return items;
+}
+
+static hf_t parse_entry_line(const char *p, const char *eol){
+	hf_id_t id;
+	uint64_t code;
+	p = parse_id(p, eol, id);
+	p = parse_code(skip_space(p, eol), eol, code);
+	if (skip_space(p, eol) != eol) throw runtime_error("trailing characters");
+	return hf_t(id, code);
+}
+
+static hf_t parse_entry_record(const char *p){
+	long long id;
+	uint64_t code;
+	memcpy(&id, p, sizeof(id));
+	memcpy(&code, p + sizeof(id), sizeof(code));
+	if ((long long)(hf_id_t)id != id) throw runtime_error("id out of range");
+	return hf_t(id, code);
+}
+
+static uint64_t parse_query_line(const char *p, const char *eol){
+	uint64_t code;
+	p = parse_code(p, eol, code);
+	if (skip_space(p, eol) != eol) throw runtime_error("trailing characters");
+	return code;
+}
+
+static uint64_t parse_query_record(const char *p){
+	uint64_t code;
+	memcpy(&code, p, sizeof(code));
+	return code;
+}
+
+static void load_index(const string &path, HFTrie &trie){
+	ifstream istrm(path, ios::binary);
+	if (!istrm) throw runtime_error("unable to open " + path);
+	trie.Load(istrm);
+}
+
+static int cmd_build(int argc, char **argv){
+	bool binary = false, learn = false, packed = false;
+	int n_threads = 0;
+	int c;
+	while ((c = getopt(argc, argv, "bt:lch")) != -1){
+		switch (c){
+		case 'b': binary = true; break;
+		case 't': n_threads = atoi(optarg); break;
+		case 'l': learn = true; break;
+		case 'c': packed = true; break;
+		default: usage(); return (c == 'h') ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2){
+		usage();
+		return 1;
+	}
+	const string input = argv[optind], index = argv[optind+1];
+
+	HFThreadPool pool(n_threads);
+	auto start = chrono::steady_clock::now();
+	vector<hf_t> entries;
+	{
+		mapped_file_t file(input);
+		entries = parse_file<hf_t>(file, binary, RECORD_SIZE, pool, parse_entry_line, parse_entry_record);
+	}
+	const size_t n = entries.size();
+	cerr << "parsed " << n << " entries in " << seconds_since(start) << "s" << endl;
+
+	start = chrono::steady_clock::now();
+	HFTrie trie;
+	trie.EnableCompression(packed);
+	trie.BulkLoad(move(entries), learn);
+	cerr << "built index in " << seconds_since(start) << "s, " << trie.MemoryUsage() << " bytes" << endl;
+
+	start = chrono::steady_clock::now();
+	ofstream ostrm(index, ios::binary);
+	if (!ostrm) throw runtime_error("unable to create " + index);
+	trie.Save(ostrm);
+	ostrm.close();
+	if (!ostrm) throw runtime_error("unable to write " + index);
+	cerr << "saved " << index << " in " << seconds_since(start) << "s" << endl;
+	return 0;
+}
+
+static int cmd_query(int argc, char **argv){
+	bool binary = false;
+	int n_threads = 0, radius = 10;
+	size_t k = 10;
+	string mode = "exact", output;
+	int c;
+	while ((c = getopt(argc, argv, "bt:m:r:k:o:h")) != -1){
+		switch (c){
+		case 'b': binary = true; break;
+		case 't': n_threads = atoi(optarg); break;
+		case 'm': mode = optarg; break;
+		case 'r': radius = atoi(optarg); break;
+		case 'k': k = strtoul(optarg, NULL, 10); break;
+		case 'o': output = optarg; break;
+		default: usage(); return (c == 'h') ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2 || (mode != "exact" && mode != "fast" && mode != "auto" && mode != "knn")){
+		usage();
+		return 1;
+	}
+
+	HFThreadPool pool(n_threads);
+	auto start = chrono::steady_clock::now();
+	HFTrie trie;
+	load_index(argv[optind], trie);
+	if (mode == "auto") trie.EnableFlatScan(true);
+	cerr << "loaded " << trie.Size() << " entries in " << seconds_since(start) << "s" << endl;
+
+	vector<uint64_t> queries;
+	{
+		mapped_file_t file(argv[optind+1]);
+		queries = parse_file<uint64_t>(file, binary, sizeof(uint64_t), pool, parse_query_line, parse_query_record);
+	}
+
+	// results of each query are formatted by the worker that ran it
+	HFHistogram latency;
+	vector<string> lines(queries.size());
+	size_t n_results = 0;
+	vector<size_t> counts(pool.Size(), 0);
+	start = chrono::steady_clock::now();
+	auto run_query = [&](size_t task, int worker){
+		auto qstart = chrono::steady_clock::now();
+		const uint64_t target = queries[task];
+		vector<hf_t> results;
+		vector<int> distances;
+		if (mode == "exact"){
+			trie.RangeSearch(target, radius, results, distances, true);
+		} else if (mode == "fast"){
+			trie.RangeSearchFast(target, radius, results, distances, true);
+		} else {
+			results = (mode == "auto") ? trie.RangeSearchAuto(target, radius, &pool) : trie.KNearestSearch(target, k);
+			for (const hf_t &e : results){
+				distances.push_back(e.hdistance(target));
+			}
+		}
+		latency.Record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - qstart).count());
+
+		ostringstream ss;
+		for (size_t i=0;i < results.size();i++){
+			ss << task << "\t" << results[i].id << "\t" << hex << results[i].code << dec << "\t" << distances[i] << "\n";
+		}
+		lines[task] = ss.str();
+		counts[worker] += results.size();
+	};
+	// the pool is not reentrant, so planned searches run in turn and scan in parallel
+	if (mode == "auto"){
+		for (size_t i=0;i < queries.size();i++){
+			run_query(i, pool.Size()-1);
+		}
+	} else {
+		pool.ParallelFor(queries.size(), run_query);
+	}
+	double elapsed = seconds_since(start);
+	for (size_t n : counts){
+		n_results += n;
+	}
+
+	ofstream file;
+	if (!output.empty()){
+		file.open(output);
+		if (!file) throw runtime_error("unable to create " + output);
+	}
+	ostream &ostrm = output.empty() ? cout : file;
+	for (const string &line : lines){
+		ostrm << line;
+	}
+
+	hf_histogram_snapshot_t hist;
+	hist.Merge(latency);
+	cerr << queries.size() << " queries, " << n_results << " results in " << elapsed << "s ("
+		 << (elapsed > 0 ? (double)queries.size()/elapsed : 0.0) << " queries/s)" << endl;
+	cerr << "latency us: mean " << hist.Mean()/1000.0 << " p50 " << hist.Percentile(0.5)/1000.0
+		 << " p99 " << hist.Percentile(0.99)/1000.0 << " max " << hist.max/1000.0 << endl;
+	return 0;
+}
+
+static int cmd_stats(int argc, char **argv){
+	double sample = 1.0;
+	int c;
+	while ((c = getopt(argc, argv, "s:h")) != -1){
+		switch (c){
+		case 's': sample = atof(optarg); break;
+		default: usage(); return (c == 'h') ? 0 : 1;
+		}
+	}
+	if (argc - optind != 1){
+		usage();
+		return 1;
+	}
+
+	auto start = chrono::steady_clock::now();
+	HFTrie trie;
+	load_index(argv[optind], trie);
+	cerr << "loaded " << trie.Size() << " entries in " << seconds_since(start) << "s" << endl;
+
+	start = chrono::steady_clock::now();
+	hf_stats_t stats = trie.Stats(sample);
+	cerr << "traversed in " << seconds_since(start) << "s" << endl;
+	cout << stats.ToJSON() << endl;
+	return 0;
+}
+
+int main(int argc, char **argv){
+	if (argc < 2){
+		usage();
+		return 1;
+	}
+
+	const string cmd = argv[1];
+	try {
+		if (cmd == "build") return cmd_build(argc - 1, argv + 1);
+		if (cmd == "query") return cmd_query(argc - 1, argv + 1);
+		if (cmd == "stats") return cmd_stats(argc - 1, argv + 1);
+	} catch (const exception &err){
+		cerr << "hftrie: " << err.what() << endl;
+		return 1;
+	}
+
+	usage();
+	return (cmd == "-h" || cmd == "help") ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+/** 
+    HFTrie - Data Structure for indexing binary codes 
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include "hft/hftrie.hpp"
+#include "hft/hfserver.hpp"
+
+using namespace std;
+using namespace hft;
+
+static HFServer *g_server = NULL;
+
+static void on_signal(int sig){
+	if (g_server != NULL) g_server->Stop();
+}
+
+static void usage(const char *prog){
+	cout << "usage: " << prog << " [-s socket_path | -p port] [-t threads] [-i index_file]" << endl;
+	cout << "  -s   listen on a unix domain socket (default /tmp/hftrie.sock)" << endl;
+	cout << "  -p   listen on 127.0.0.1:port instead" << endl;
+	cout << "  -t   number of worker threads (default: all cores)" << endl;
+	cout << "  -i   load an index saved with HFTrie::Save" << endl;
+}
+
+int main(int argc, char **argv){
+
+	string path = "/tmp/hftrie.sock";
+	string index_file;
+	int port = -1;
+	int n_threads = 0;
+
+	int c;
+	while ((c = getopt(argc, argv, "s:p:t:i:h")) != -1){
+		switch (c){
+		case 's': path = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 't': n_threads = atoi(optarg); break;
+		case 'i': index_file = optarg; break;
+		default:
+			usage(argv[0]);
+			return (c == 'h') ? 0 : 1;
+		}
+	}
+
+	try {
+		HFTrie trie;
+		if (!index_file.empty()){
+			ifstream istrm(index_file, ios::binary);
+			if (!istrm) throw runtime_error("unable to open " + index_file);
+			trie.Load(istrm);
+			cout << "loaded " << trie.Size() << " entries from " << index_file << endl;
+		}
+
+		HFServer server(trie, n_threads);
+		if (port >= 0){
+			port = server.ListenTCP(port);
+			cout << "listening on 127.0.0.1:" << port << endl;
+		} else {
+			server.ListenUnix(path);
+			cout << "listening on " << path << endl;
+		}
+
+		g_server = &server;
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+		server.Run();
+		g_server = NULL;
+	} catch (const exception &err){
+		cerr << "hftrie_server: " << err.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}